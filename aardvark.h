@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <sys/types.h>
 
 // Syntax tree node types
@@ -13,8 +14,11 @@ enum {
 	TOKEN_STRING,
 	// Punctuation + Operators
 	TOKEN_COMMA,
+	TOKEN_DOT,
 	TOKEN_L_PAREN,
 	TOKEN_R_PAREN,
+	TOKEN_L_BRACKET,
+	TOKEN_R_BRACKET,
 	TOKEN_PLUS,
 	TOKEN_MINUS,
 	TOKEN_MULTIPLY,
@@ -28,15 +32,22 @@ enum {
 	TOKEN_GREATER_EQUAL,
 	TOKEN_LESS_EQUAL,
 	// Keywords
+	TOKEN_AND,
+	TOKEN_BENCH,
 	TOKEN_DO,
 	TOKEN_ELSE,
 	TOKEN_END,
 	TOKEN_FN,
+	TOKEN_FOR,
 	TOKEN_IF,
+	TOKEN_IMPORT,
+	TOKEN_OR,
+	TOKEN_PARALLEL,
 	TOKEN_RETURN,
 	TOKEN_THEN,
 	TOKEN_VAR,
 	TOKEN_WHILE,
+	TOKEN_YIELD,
 	// Syntax (grammar productions)
 	SYNTAX_PROGRAM,
 	SYNTAX_FUNCTION,
@@ -49,14 +60,40 @@ enum {
 	SYNTAX_RETURN,
 	SYNTAX_IF,
 	SYNTAX_WHILE,
+	SYNTAX_FOR,
+	SYNTAX_PARALLEL_FOR,
+	SYNTAX_INDEX,
+	SYNTAX_INDEX_ASSIGNMENT,
+	SYNTAX_YIELD,
+	SYNTAX_LAZY_BLOCK,	// Function body that has not been parsed yet, see parseLazyBlock()
+	SYNTAX_IMPORT,
+	SYNTAX_BENCH,
 	// Runtime
-	RUNTIME_STANDARD_FUNCTION,
+	RUNTIME_NATIVE_FUNCTION,
 	RUNTIME_KNOWN_FUNCTION,
+	RUNTIME_GENERATOR_CALL,	// Call of a function that contains 'yield', creates a coroutine
+	RUNTIME_INLINED_CALL,	// Arguments and a copy of the returned expression, see inline.c
 	RUNTIME_KNOWN_VARIABLE,
 	RUNTIME_KNOWN_GLOBAL_VARIABLE,
+	RUNTIME_COUNTED_WHILE,	// SYNTAX_WHILE with an integer counter, step in data.integerLiteral
+	RUNTIME_REDUCTIONS,		// Last child of SYNTAX_PARALLEL_FOR, the outer variables that it sums into
+	// Quickened by eval(), the operator is kept in ParseNode::generic
+	RUNTIME_LOCAL_OP_CONST,
+	RUNTIME_LOCAL_OP_LOCAL,
+	RUNTIME_GLOBAL_OP_CONST,
+	RUNTIME_INCREMENT_LOCAL,	// 'x = x + c' with c in data.integerLiteral
+	RUNTIME_INCREMENT_GLOBAL,
 };
 typedef uint8_t	Syntax;
 
+// Static types found by inferProgram()
+enum {
+	INFERRED_NONE = 0,
+	INFERRED_INTEGER,
+	INFERRED_STRING,
+	INFERRED_UNKNOWN,
+};
+
 typedef union TokenData	TokenData;
 union TokenData {
 	uint64_t	identifier;
@@ -64,28 +101,43 @@ union TokenData {
 	const char*	stringLiteral;
 };
 
-typedef struct {
-	TokenData	data;
-	Syntax		syntax;
-} Token;
+// NOTE:	Token lists are stored as a structure of arrays
+//			- 'syntax' has one byte per token, which is all the parser looks at to decide what to do
+//			- 'data' has the payloads of the tokens that carry one (TOKEN_HAS_DATA()), in the same order
+#define TOKEN_HAS_DATA(s)	((s) == TOKEN_IDENTIFIER || (s) == TOKEN_INTEGER || (s) == TOKEN_STRING)
 
 typedef struct {
-	Token*	tokens;
-	size_t	tokenCapacity;
-	size_t	tokenCount;
+	Syntax*		syntax;
+	TokenData*	data;
+	size_t		tokenCapacity;
+	size_t		tokenCount;
+	size_t		dataCapacity;
+	size_t		dataCount;
+	uint32_t*	offsets;	// Source offset of every token, only kept on request by tokenizeChecked()
 } TokenList;
 
+// Position in a TokenList, 'data' is the payload of the first token at or after 'syntax' that has one
+typedef struct {
+	const Syntax*		syntax;
+	const TokenData*	data;
+} TokenCursor;
+
 typedef struct ParseNode	ParseNode;
+typedef struct Native		Native;
 struct ParseNode {
 	union {
-		TokenData	data;
-		ParseNode*	function;
-		ssize_t		stackIndex;
+		TokenData		data;
+		ParseNode*		function;
+		const Native*	native;
+		ssize_t			stackIndex;
+		TokenList*		tokens;	// SYNTAX_LAZY_BLOCK
 	};
 	ParseNode*	children;
-	uint16_t	childCapacity;
-	uint16_t	childCount;
+	uint32_t	childCapacity;
+	uint32_t	childCount;
 	Syntax		syntax;
+	uint8_t		inferred;
+	Syntax		generic;	// Syntax before quickening, SYNTAX_NONE until eval() has tried
 };
 
 typedef enum Type	Type;
@@ -94,6 +146,55 @@ enum Type {
 	TYPE_VOID,
 	TYPE_INTEGER,
 	TYPE_STRING,
+	TYPE_MAP,
+	TYPE_COROUTINE,
+	TYPE_BIGINT,	// Integer that does not fit in an int64_t, see bigint.c
+};
+
+typedef struct Object		Object;
+typedef struct Map			Map;
+typedef struct Coroutine	Coroutine;
+typedef struct Bigint		Bigint;
+
+// Heap object kinds
+enum {
+	OBJECT_MAP,
+	OBJECT_COROUTINE,
+	OBJECT_BIGINT,
+};
+
+// Header of every garbage collected value, must be the first member
+struct Object {
+	Object*		next;
+	uint32_t	size;
+	uint8_t		kind;
+	uint8_t		color;
+};
+
+#define BENCH_MAX_SAMPLES	100
+
+// Timing of a 'bench' block, see bench.c
+typedef struct Bench	Bench;
+struct Bench {
+	double		samples[BENCH_MAX_SAMPLES];	// Nanoseconds per iteration
+	size_t		sampleCount;
+	uint64_t	batch;		// Iterations per sample
+	uint64_t	begin;		// Of the batch that is running
+	uint64_t	end;		// Of the warm-up, then of the measurement
+	bool		measuring;
+};
+
+typedef struct GcStats	GcStats;
+struct GcStats {
+	size_t		cycles;
+	size_t		steps;
+	uint64_t	totalPause;	// Nanoseconds
+	uint64_t	maxPause;	// Nanoseconds
+	size_t		freedObjects;
+	size_t		freedRegions;
+	size_t		liveBytes;
+	size_t		peakBytes;
+	size_t		chunkBytes;
 };
 
 typedef struct Data	Data;
@@ -101,17 +202,188 @@ struct Data {
 	union {
 		int64_t		integer;
 		const char*	string;
+		Map*		map;
+		Coroutine*	coroutine;
+		Bigint*		bigint;
 	};
 	Type	type;
 };
 
+// C function callable from scripts, 'args' points at 'argCount' values on the value stack
+typedef Data (*NativeFunction)(const Data* args, uint16_t argCount);
+
+#define NATIVE_ANY_ARITY	-1
+
+// Native flags
+enum {
+	NATIVE_PURE			= 0x1,	// No side effects, the result only depends on the argument values
+	NATIVE_RUNS_SCRIPT	= 0x2,	// May run script code, e.g. by resuming a generator
+	NATIVE_MUTATES		= 0x4,	// Modifies the map that is its first argument
+	NATIVE_SERIAL		= 0x8,	// Uses state of the process that is not thread safe, e.g. a buffer
+};
+
+struct Native {
+	uint64_t		identifier;	// hash() of the name
+	NativeFunction	function;
+	int16_t			arity;
+	uint8_t			flags;
+	uint8_t			result;		// INFERRED_*
+};
+
+// Functions of another file, see module.c
+typedef struct Module	Module;
+struct Module {
+	char*		path;	// Canonical, see realpath()
+	uint64_t	name;	// hash() of the file name without its extension
+	ParseNode*	root;
+};
+
+// What an allocation is counted as by memoryTrackingAllocator()
+enum {
+	MEMORY_SOURCE,
+	MEMORY_TOKENS,
+	MEMORY_SYNTAX_TREE,
+	MEMORY_ANALYSIS,	// Tables of resolveProgram() and inferProgram()
+	MEMORY_STACKS,		// Value stacks
+	MEMORY_HEAP,		// Garbage collected objects and what they own
+	MEMORY_TRACE,		// Events of --trace
+	MEMORY_SUBSYSTEM_COUNT,
+};
+
+// Like realloc(), freeing when 'size' is 0, returns NULL if the memory cannot be allocated
+// 'subsystem' is only meaningful when a block is allocated
+typedef struct Allocator	Allocator;
+struct Allocator {
+	void*	(*reallocate)(Allocator* allocator, void* memory, size_t size, uint8_t subsystem);
+};
+
+typedef struct MemoryStats	MemoryStats;
+struct MemoryStats {
+	size_t	live[MEMORY_SUBSYSTEM_COUNT];
+	size_t	peak[MEMORY_SUBSYSTEM_COUNT];
+	size_t	totalLive;
+	size_t	totalPeak;
+};
+
+// Runs one task of a poolRun() batch, may be called from any thread
+typedef void (*PoolTask)(void* context, size_t index);
+// Runs the iterations [first, last) of a poolFor() loop for 'worker'
+typedef void (*PoolRangeTask)(void* context, size_t worker, int64_t first, int64_t last);
+
+// The value stack of the main program or of a coroutine, see evalSwapStack()
+typedef struct ValueStack	ValueStack;
+struct ValueStack {
+	Data*	values;
+	size_t	count;
+	size_t	capacity;
+	size_t	frameStart;
+};
+
+void memoryUse(Allocator* allocator);
+Allocator* memoryDefaultAllocator(void);
+Allocator* memoryTrackingAllocator(void);
+Allocator* memoryBudgetedAllocator(size_t limit);
+MemoryStats memoryStats(void);
+void* memoryAllocate(size_t size, uint8_t subsystem);
+void* memoryAllocateZeroed(size_t size, uint8_t subsystem);
+void* memoryReallocate(void* memory, size_t size, uint8_t subsystem);
+void memoryFree(void* memory);
+size_t poolThreadCount(void);
+void poolRun(PoolTask task, void* context, size_t count);
+void poolFor(PoolRangeTask task, void* context, int64_t first, int64_t last);
+void poolForked(void);
 TokenList tokenize(const char* chars, size_t count);
+bool tokenizeChecked(const char* chars, size_t count, bool offsets, TokenList* list);
 void printSyntax(Syntax s);
 uint64_t hash(const uint8_t* data, size_t size);
-ParseNode* parseProgram(const TokenList* list);
-void parseNodeRemoveChild(ParseNode* parent, uint16_t i);
+uint64_t hashMix(uint64_t x);
+ParseNode* parseProgram(const TokenList* list, bool lazy);
+bool parseNextComponent(TokenCursor* t, const Syntax* const end, ParseNode* root);
+void parseLazyBlock(ParseNode* block);
+void parseNodeCreate(ParseNode* node, Syntax s);
+void parseNodeRemoveChild(ParseNode* parent, uint32_t i);
 void parseTreeFree(ParseNode* root);
 void parseTreePrint(const ParseNode* root);
+void resolveProgram(ParseNode* root);
+bool resolveProgramChecked(ParseNode* root);
+void resolveReset(void);
+void resolveModule(ParseNode* root);
+bool resolveReload(ParseNode* const* changed, size_t count);
+void nativeRegister(const char* name, NativeFunction function, int16_t arity, uint8_t flags, uint8_t result);
+const Native* nativeFind(uint64_t identifier);
+void nativeFlush(void);
+void inferProgram(ParseNode* root);
+void inferModule(ParseNode* root);
+void inferReset(void);
+void inlineProgram(ParseNode* root, size_t limit);
+void linesWrap(ParseNode* root, bool print);
 Data eval(ParseNode* node);
+void evalGlobals(ParseNode* node);
+Data evalStatements(ParseNode* node);
+void evalMarkRoots(void);
+void evalRequestReload(void);
+void evalForgetTypes(ParseNode* node);
+int64_t evalFuel(void);
+void evalSetFuel(int64_t units);
+void evalSetTracing(bool enabled);
+ValueStack evalSwapStack(ValueStack next);
+const Module* moduleImport(const char* path);
+void moduleSetMainPath(const char* path);
+void moduleAbandon(void);
+Data watchRun(const char* path, char* chars, size_t size);
+void watchReload(void);
+void serverRun(const char* path, ParseNode* root);
+int serverConnect(const char* path);
+ParseNode* serverDaemon(const char* path, size_t cacheLimit, size_t inlineLimit);
+int serverSubmit(const char* path, const char* chars, size_t size);
+int serverStats(const char* path);
+Coroutine* coroutineCreate(ParseNode* function, const Data* args, uint16_t argCount);
+void coroutineFinalize(Coroutine* coroutine);
+void coroutineTrace(const Coroutine* coroutine, size_t* work);
+void coroutineMarkRoots(void);
+Data coroutineResume(Coroutine* coroutine);
+void coroutineYield(Data value);
+bool coroutineDone(const Coroutine* coroutine);
+Coroutine* coroutineCurrent(void);
+void benchStart(Bench* bench);
+uint64_t benchNext(Bench* bench);
+void benchReport(const Bench* bench, const char* name);
+void traceStart(const char* path);
+void traceName(uint64_t identifier, const char* chars, size_t length);
+void traceEnter(uint64_t identifier);
+void traceExit(void);
+uint64_t traceLoopBegin(void);
+void traceLoopEnd(uint64_t begin);
+void tracePhase(const char* name);
+void schedulerSetFuelLimit(int64_t units);
+void schedulerOutOfFuel(void);
+void schedulerSpawn(Coroutine* task);
+void schedulerRun(void);
+void schedulerMarkRoots(void);
+void* gcAllocate(uint8_t kind, size_t size);
+void gcTrack(ssize_t bytes);
+void gcShade(Data d);
+void gcAddRegion(void* memory, size_t size, void (*release)(void* memory, size_t size));
+void gcBarrier(Data d);
+void gcRetrace(Object* object);
+void gcBarrierResume(Coroutine* coroutine);
+void gcPause(bool pause);
+GcStats gcStats(void);
+Data bigintArithmetic(Syntax operator, Data a, Data b);
+int bigintCompare(Data a, Data b);
+uint64_t bigintHash(const Bigint* bigint);
+void bigintPrint(const Bigint* bigint);
+Map* mapCreate(void);
+void mapFinalize(Map* map);
+size_t mapTrace(const Map* map, size_t cursor, size_t budget, size_t* work);
+size_t mapSize(const Map* map);
+Data mapGet(const Map* map, Data key);
+bool mapContains(const Map* map, Data key);
+void mapSet(Map* map, Data key, Data value);
+bool mapDelete(Map* map, Data key);
+uint32_t mapVersion(const Map* map);
+size_t mapNext(const Map* map, size_t cursor);
+Data mapKeyAt(const Map* map, size_t cursor);
+Data mapValueAt(const Map* map, size_t cursor);
 
 #endif //_AARDVARK_H
@@ -0,0 +1,100 @@
+#define _POSIX_C_SOURCE 200809L
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// NOTE:	'bench "name" do ... end' measures how long its body takes, and prints one line of JSON to stdout:
+//			{"bench": name, "batch": iterations per sample, "samples": count, "min_ns", "median_ns", "p99_ns",
+//			"mean_ns", "stddev_ns"}, times per iteration in nanoseconds (CLOCK_MONOTONIC)
+//			- The body first runs for WARM_UP_NANOSECONDS, so that it is quickened and caches are warm, while the
+//			  batch of iterations is doubled until it takes at least BATCH_NANOSECONDS, which makes the clock
+//			  cheap and precise compared to the batch
+//			- Then every batch is a sample, until there are BENCH_MAX_SAMPLES of them or MEASURE_NANOSECONDS have
+//			  passed, but never fewer than MIN_SAMPLES
+//			- Nothing in the interpreter removes statements whose results are unused, so the body runs as written
+//			- Every iteration burns fuel like a loop iteration
+#define WARM_UP_NANOSECONDS		50000000
+#define MEASURE_NANOSECONDS		1000000000
+#define BATCH_NANOSECONDS		1000000
+#define MIN_SAMPLES				5
+
+static uint64_t _now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void benchStart(Bench* bench) {
+	bench->sampleCount = 0;
+	bench->batch = 1;
+	bench->measuring = false;
+	bench->begin = _now();
+	bench->end = bench->begin + WARM_UP_NANOSECONDS;
+}
+
+// Returns the number of iterations to run before the next call, 0 when the measurement is over
+uint64_t benchNext(Bench* bench) {
+	const uint64_t now = _now();
+	const uint64_t elapsed = now - bench->begin;
+	if (bench->measuring) {
+		bench->samples[bench->sampleCount++] = (double)elapsed / bench->batch;
+		if (bench->sampleCount == BENCH_MAX_SAMPLES || (now >= bench->end && bench->sampleCount >= MIN_SAMPLES)) {
+			return 0;
+		}
+	}
+	else if (elapsed < BATCH_NANOSECONDS && bench->batch < UINT64_MAX / 2) {
+		bench->batch *= 2;
+	}
+	else if (now >= bench->end) {
+		bench->measuring = true;
+		bench->end = now + MEASURE_NANOSECONDS;
+	}
+	bench->begin = _now();
+	return bench->batch;
+}
+
+static int _compare(const void* a, const void* b) {
+	const double x = *(const double*)a;
+	const double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+void benchReport(const Bench* bench, const char* name) {
+	double sorted[BENCH_MAX_SAMPLES];
+	const size_t count = bench->sampleCount;
+	memcpy(sorted, bench->samples, count * sizeof *sorted);
+	qsort(sorted, count, sizeof *sorted, _compare);
+	double mean = 0;
+	for (size_t i = 0; i < count; ++i) {
+		mean += sorted[i];
+	}
+	mean /= count;
+	double variance = 0;
+	for (size_t i = 0; i < count; ++i) {
+		variance += (sorted[i] - mean) * (sorted[i] - mean);
+	}
+	variance /= count - 1;
+	const double median = count % 2 == 1 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+	// Nearest rank
+	const size_t p99 = (count * 99 + 99) / 100 - 1;
+	printf("{\"bench\": \"");
+	for (const char* c = name; *c != '\0'; ++c) {
+		if (*c == '"' || *c == '\\') {
+			putchar('\\');
+			putchar(*c);
+		}
+		else if (*c == '\n') {
+			printf("\\n");
+		}
+		else {
+			putchar(*c);
+		}
+	}
+	printf("\", \"batch\": %lu, \"samples\": %zu, \"min_ns\": %.2f, \"median_ns\": %.2f, \"p99_ns\": %.2f, "
+		"\"mean_ns\": %.2f, \"stddev_ns\": %.2f}\n", bench->batch, count, sorted[0], median, sorted[p99], mean,
+		sqrt(variance));
+}
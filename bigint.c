@@ -0,0 +1,398 @@
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// NOTE:	Integers that do not fit in an int64_t are Bigints: a sign and a magnitude of 32 bit limbs, least
+//			significant first
+//			- Bigints are immutable and always normalized, a value that fits in an int64_t is never a Bigint,
+//			  so TYPE_INTEGER and TYPE_BIGINT never hold the same value
+//			- Work is done in memoryAllocate()'d scratch buffers, only the final result is allocated with gcAllocate(),
+//			  after the operands were last read
+//			- Multiplication switches from schoolbook to Karatsuba at KARATSUBA_THRESHOLD limbs
+#define KARATSUBA_THRESHOLD	32
+#define DECIMAL_BASE		1000000000	// Largest power of 10 that fits in a limb
+
+struct Bigint {
+	Object		object;
+	uint32_t	count;
+	bool		negative;
+	uint32_t	limbs[];
+};
+
+// An operand viewed as a magnitude, whether it is a small integer or a Bigint
+typedef struct Number	Number;
+struct Number {
+	const uint32_t*	limbs;
+	size_t			count;
+	bool			negative;
+	uint32_t		small[2];
+};
+
+static void _view(Number* n, Data d) {
+	switch (d.type) {
+	case TYPE_INTEGER: {
+		n->negative = d.integer < 0;
+		const uint64_t magnitude = n->negative ? -(uint64_t)d.integer : (uint64_t)d.integer;
+		n->small[0] = (uint32_t)magnitude;
+		n->small[1] = (uint32_t)(magnitude >> 32);
+		n->limbs = n->small;
+		n->count = n->small[1] != 0 ? 2 : n->small[0] != 0;
+		break;
+	}
+	case TYPE_BIGINT:
+		n->negative = d.bigint->negative;
+		n->limbs = d.bigint->limbs;
+		n->count = d.bigint->count;
+		break;
+	default:
+		fprintf(stderr, "Error: Expected an integer operand\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static size_t _trim(const uint32_t* a, size_t n) {
+	while (n != 0 && a[n - 1] == 0) {
+		--n;
+	}
+	return n;
+}
+
+static uint32_t* _scratch(size_t n) {
+	return memoryAllocateZeroed((n == 0 ? 1 : n) * sizeof(uint32_t), MEMORY_HEAP);
+}
+
+static int _compareMagnitude(const uint32_t* a, size_t an, const uint32_t* b, size_t bn) {
+	an = _trim(a, an);
+	bn = _trim(b, bn);
+	if (an != bn) {
+		return an < bn ? -1 : 1;
+	}
+	for (size_t i = an; i-- != 0;) {
+		if (a[i] != b[i]) {
+			return a[i] < b[i] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+// r += a, r has rn limbs and must be large enough for the result
+static void _addInto(uint32_t* r, size_t rn, const uint32_t* a, size_t an) {
+	uint64_t carry = 0;
+	size_t i = 0;
+	for (; i < an; ++i) {
+		carry += (uint64_t)r[i] + a[i];
+		r[i] = (uint32_t)carry;
+		carry >>= 32;
+	}
+	for (; carry != 0; ++i) {
+		assert(i < rn);
+		carry += r[i];
+		r[i] = (uint32_t)carry;
+		carry >>= 32;
+	}
+	(void)rn;
+}
+
+// r -= a, r must not be smaller than a
+static void _subInto(uint32_t* r, size_t rn, const uint32_t* a, size_t an) {
+	int64_t borrow = 0;
+	size_t i = 0;
+	for (; i < an; ++i) {
+		borrow += (int64_t)r[i] - a[i];
+		r[i] = (uint32_t)borrow;
+		borrow >>= 32;
+	}
+	for (; borrow != 0; ++i) {
+		assert(i < rn);
+		borrow += r[i];
+		r[i] = (uint32_t)borrow;
+		borrow >>= 32;
+	}
+	(void)rn;
+}
+
+// r has an + bn limbs
+static void _mulSchoolbook(uint32_t* r, const uint32_t* a, size_t an, const uint32_t* b, size_t bn) {
+	memset(r, 0, (an + bn) * sizeof *r);
+	for (size_t i = 0; i < bn; ++i) {
+		uint64_t carry = 0;
+		for (size_t j = 0; j < an; ++j) {
+			carry += (uint64_t)a[j] * b[i] + r[i + j];
+			r[i + j] = (uint32_t)carry;
+			carry >>= 32;
+		}
+		r[i + an] = (uint32_t)carry;
+	}
+}
+
+// r has an + bn limbs
+static void _mul(uint32_t* r, const uint32_t* a, size_t an, const uint32_t* b, size_t bn) {
+	if (an < bn) {
+		const uint32_t* t = a;
+		a = b;
+		b = t;
+		const size_t tn = an;
+		an = bn;
+		bn = tn;
+	}
+	if (bn < KARATSUBA_THRESHOLD) {
+		_mulSchoolbook(r, a, an, b, bn);
+		return;
+	}
+	const size_t m = (an + 1) / 2;
+	if (bn <= m) {
+		// Unbalanced, multiply both halves of a by b
+		memset(r, 0, (an + bn) * sizeof *r);
+		uint32_t* t = _scratch(m + bn);
+		_mul(t, a, m, b, bn);
+		_addInto(r, an + bn, t, m + bn);
+		_mul(t, a + m, an - m, b, bn);
+		_addInto(r + m, an + bn - m, t, an - m + bn);
+		memoryFree(t);
+		return;
+	}
+	// a = a1 * B^m + a0, b = b1 * B^m + b0
+	// a * b = z2 * B^2m + ((a0 + a1) * (b0 + b1) - z2 - z0) * B^m + z0
+	const size_t z2n = an + bn - 2 * m;
+	_mul(r, a, m, b, m);
+	_mul(r + 2 * m, a + m, an - m, b + m, bn - m);
+	uint32_t* sa = _scratch(m + 1);
+	uint32_t* sb = _scratch(m + 1);
+	memcpy(sa, a, m * sizeof *sa);
+	memcpy(sb, b, m * sizeof *sb);
+	_addInto(sa, m + 1, a + m, an - m);
+	_addInto(sb, m + 1, b + m, bn - m);
+	uint32_t* z1 = _scratch(2 * m + 2);
+	_mul(z1, sa, m + 1, sb, m + 1);
+	_subInto(z1, 2 * m + 2, r, 2 * m);
+	_subInto(z1, 2 * m + 2, r + 2 * m, z2n);
+	_addInto(r + m, an + bn - m, z1, _trim(z1, 2 * m + 2));
+	memoryFree(sa);
+	memoryFree(sb);
+	memoryFree(z1);
+}
+
+// Knuth's algorithm D, q has an - bn + 1 limbs, a and b are trimmed and a >= b
+static void _div(uint32_t* q, const uint32_t* a, size_t an, const uint32_t* b, size_t bn) {
+	if (bn == 1) {
+		uint64_t remainder = 0;
+		for (size_t i = an; i-- != 0;) {
+			const uint64_t current = remainder << 32 | a[i];
+			q[i] = (uint32_t)(current / b[0]);
+			remainder = current % b[0];
+		}
+		return;
+	}
+	// Normalize so that the top limb of the divisor has its high bit set
+	const int s = __builtin_clz(b[bn - 1]);
+	uint32_t* vn = _scratch(bn);
+	uint32_t* un = _scratch(an + 1);
+	for (size_t i = bn - 1; i > 0; --i) {
+		vn[i] = b[i] << s | (uint32_t)((uint64_t)b[i - 1] >> (32 - s));
+	}
+	vn[0] = b[0] << s;
+	un[an] = (uint32_t)((uint64_t)a[an - 1] >> (32 - s));
+	for (size_t i = an - 1; i > 0; --i) {
+		un[i] = a[i] << s | (uint32_t)((uint64_t)a[i - 1] >> (32 - s));
+	}
+	un[0] = a[0] << s;
+	for (size_t j = an - bn + 1; j-- != 0;) {
+		const uint64_t numerator = (uint64_t)un[j + bn] << 32 | un[j + bn - 1];
+		uint64_t qhat = numerator / vn[bn - 1];
+		uint64_t rhat = numerator % vn[bn - 1];
+		while (qhat >> 32 != 0 || qhat * vn[bn - 2] > (rhat << 32 | un[j + bn - 2])) {
+			--qhat;
+			rhat += vn[bn - 1];
+			if (rhat >> 32 != 0) {
+				break;
+			}
+		}
+		// Multiply and subtract
+		int64_t k = 0;
+		int64_t t;
+		for (size_t i = 0; i < bn; ++i) {
+			const uint64_t p = qhat * vn[i];
+			t = (int64_t)un[i + j] - k - (int64_t)(p & 0xffffffff);
+			un[i + j] = (uint32_t)t;
+			k = (int64_t)(p >> 32) - (t >> 32);
+		}
+		t = (int64_t)un[j + bn] - k;
+		un[j + bn] = (uint32_t)t;
+		q[j] = (uint32_t)qhat;
+		if (t < 0) {
+			// qhat was one too large, add the divisor back
+			--q[j];
+			uint64_t carry = 0;
+			for (size_t i = 0; i < bn; ++i) {
+				carry += (uint64_t)un[i + j] + vn[i];
+				un[i + j] = (uint32_t)carry;
+				carry >>= 32;
+			}
+			un[j + bn] += (uint32_t)carry;
+		}
+	}
+	memoryFree(vn);
+	memoryFree(un);
+}
+
+// Takes ownership of 'limbs', returns a small integer when the value fits
+static Data _result(uint32_t* limbs, size_t count, bool negative) {
+	count = _trim(limbs, count);
+	Data result;
+	if (count <= 2) {
+		const uint64_t magnitude = count == 0 ? 0 : (uint64_t)(count == 2 ? limbs[1] : 0) << 32 | limbs[0];
+		if (magnitude <= INT64_MAX || (negative && magnitude == (uint64_t)INT64_MAX + 1)) {
+			memoryFree(limbs);
+			result.type = TYPE_INTEGER;
+			result.integer = negative ? (int64_t)-magnitude : (int64_t)magnitude;
+			return result;
+		}
+	}
+	Bigint* bigint = gcAllocate(OBJECT_BIGINT, sizeof *bigint + count * sizeof *bigint->limbs);
+	bigint->count = count;
+	bigint->negative = negative;
+	memcpy(bigint->limbs, limbs, count * sizeof *limbs);
+	memoryFree(limbs);
+	result.type = TYPE_BIGINT;
+	result.bigint = bigint;
+	return result;
+}
+
+static Data _add(const Number* a, const Number* b, bool bNegative) {
+	const size_t n = (a->count > b->count ? a->count : b->count) + 1;
+	uint32_t* r = _scratch(n);
+	if (a->negative == bNegative) {
+		memcpy(r, a->limbs, a->count * sizeof *r);
+		_addInto(r, n, b->limbs, b->count);
+		return _result(r, n, a->negative);
+	}
+	// Different signs: subtract the smaller magnitude from the larger one
+	if (_compareMagnitude(a->limbs, a->count, b->limbs, b->count) >= 0) {
+		memcpy(r, a->limbs, a->count * sizeof *r);
+		_subInto(r, n, b->limbs, b->count);
+		return _result(r, n, a->negative);
+	}
+	memcpy(r, b->limbs, b->count * sizeof *r);
+	_subInto(r, n, a->limbs, a->count);
+	return _result(r, n, bNegative);
+}
+
+static int _compare(const Number* a, const Number* b) {
+	const bool aZero = _trim(a->limbs, a->count) == 0;
+	const bool bZero = _trim(b->limbs, b->count) == 0;
+	const bool aNegative = a->negative && !aZero;
+	const bool bNegative = b->negative && !bZero;
+	if (aNegative != bNegative) {
+		return aNegative ? -1 : 1;
+	}
+	const int c = _compareMagnitude(a->limbs, a->count, b->limbs, b->count);
+	return aNegative ? -c : c;
+}
+
+int bigintCompare(Data a, Data b) {
+	Number x, y;
+	_view(&x, a);
+	_view(&y, b);
+	return _compare(&x, &y);
+}
+
+// NOTE:	The operands must be reachable by the collector (e.g. on the value stack), the result is not
+Data bigintArithmetic(Syntax operator, Data a, Data b) {
+	Number x, y;
+	_view(&x, a);
+	_view(&y, b);
+	Data result = { .type = TYPE_INTEGER };
+	switch (operator) {
+	case TOKEN_PLUS:
+		return _add(&x, &y, y.negative);
+	case TOKEN_MINUS:
+		return _add(&x, &y, !y.negative);
+	case TOKEN_MULTIPLY: {
+		if (x.count == 0 || y.count == 0) {
+			result.integer = 0;
+			return result;
+		}
+		uint32_t* r = _scratch(x.count + y.count);
+		_mul(r, x.limbs, x.count, y.limbs, y.count);
+		return _result(r, x.count + y.count, x.negative != y.negative);
+	}
+	case TOKEN_DIVIDE: {
+		const size_t an = _trim(x.limbs, x.count);
+		const size_t bn = _trim(y.limbs, y.count);
+		if (bn == 0) {
+			fprintf(stderr, "Error: Division by zero\n");
+			exit(EXIT_FAILURE);
+		}
+		// Truncates toward zero like int64_t division
+		if (_compareMagnitude(x.limbs, an, y.limbs, bn) < 0) {
+			result.integer = 0;
+			return result;
+		}
+		uint32_t* q = _scratch(an - bn + 1);
+		_div(q, x.limbs, an, y.limbs, bn);
+		return _result(q, an - bn + 1, x.negative != y.negative);
+	}
+	case TOKEN_EQUAL:
+		result.integer = _compare(&x, &y) == 0;
+		return result;
+	case TOKEN_NOT_EQUAL:
+		result.integer = _compare(&x, &y) != 0;
+		return result;
+	case TOKEN_GREATER:
+		result.integer = _compare(&x, &y) > 0;
+		return result;
+	case TOKEN_LESS:
+		result.integer = _compare(&x, &y) < 0;
+		return result;
+	case TOKEN_GREATER_EQUAL:
+		result.integer = _compare(&x, &y) >= 0;
+		return result;
+	case TOKEN_LESS_EQUAL:
+		result.integer = _compare(&x, &y) <= 0;
+		return result;
+	default:
+		fprintf(stderr, "Error: Invalid integer operator\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+uint64_t bigintHash(const Bigint* bigint) {
+	uint64_t result = 0xcbf29ce484222325 ^ bigint->negative;
+	for (uint32_t i = 0; i < bigint->count; ++i) {
+		result ^= bigint->limbs[i];
+		result *= 0x100000001b3;
+	}
+	return result;
+}
+
+// NOTE:	The magnitude is converted 9 digits at a time, by repeated division by DECIMAL_BASE
+void bigintPrint(const Bigint* bigint) {
+	size_t n = bigint->count;
+	uint32_t* limbs = _scratch(n);
+	memcpy(limbs, bigint->limbs, n * sizeof *limbs);
+	// Each limb holds at most 10 decimal digits, so this many chunks of 9 digits are enough
+	uint32_t* chunks = _scratch(n * 10 / 9 + 2);
+	size_t chunkCount = 0;
+	while (n != 0) {
+		uint64_t remainder = 0;
+		for (size_t i = n; i-- != 0;) {
+			const uint64_t current = remainder << 32 | limbs[i];
+			limbs[i] = (uint32_t)(current / DECIMAL_BASE);
+			remainder = current % DECIMAL_BASE;
+		}
+		chunks[chunkCount++] = (uint32_t)remainder;
+		n = _trim(limbs, n);
+	}
+	if (bigint->negative) {
+		putchar('-');
+	}
+	printf("%u", chunkCount == 0 ? 0 : chunks[chunkCount - 1]);
+	for (size_t i = chunkCount - 1; i-- != 0;) {
+		printf("%09u", chunks[i]);
+	}
+	memoryFree(limbs);
+	memoryFree(chunks);
+}
@@ -0,0 +1,204 @@
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700
+#undef _FORTIFY_SOURCE	// longjmp checks reject jumps between stacks
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <setjmp.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+// NOTE:	Coroutines run the body of a generator function with their own value stack and their own C stack
+//			- Calling a function that contains 'yield' creates a coroutine, next() resumes it
+//			- Switching is _setjmp()/_longjmp() only, ucontext is used once to start on the new C stack
+//			- While a coroutine runs its value stack is the one in eval.c, the resumer's stack is kept here
+//			- C stacks are mapped with a guard page, and released as soon as the body returns to a small cache
+//			  so that short lived generators do not pay for mmap() and munmap()
+#define C_STACK_SIZE		(1024 * 1024)
+#define GUARD_SIZE			4096
+#define MAX_FREE_C_STACKS	256		// As many as one collector step can finalize
+#define INITIAL_VALUES		16
+
+enum {
+	STATE_CREATED,
+	STATE_SUSPENDED,
+	STATE_RUNNING,
+	STATE_DONE,
+};
+
+struct Coroutine {
+	Object		object;
+	ParseNode*	function;
+	ValueStack	stack;			// Empty while running
+	ValueStack	resumerStack;
+	Coroutine*	resumer;		// NULL when resumed by the main program
+	uint8_t*	cStack;
+	jmp_buf		context;
+	jmp_buf		resumerContext;
+	Data		transfer;		// Value passed by the last yield or return
+	uint8_t		state;
+};
+
+static Coroutine* current = NULL;
+static Coroutine* starting = NULL;
+static ucontext_t startContext;
+static uint8_t* freeCStacks[MAX_FREE_C_STACKS];
+static size_t freeCStackCount = 0;
+
+static uint8_t* _acquireCStack(void) {
+	if (freeCStackCount != 0) {
+		return freeCStacks[--freeCStackCount];
+	}
+	uint8_t* memory = mmap(NULL, C_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		fprintf(stderr, "Error: Could not allocate a coroutine stack\n");
+		exit(EXIT_FAILURE);
+	}
+	// Stacks grow down, so the guard page is at the lowest address
+	mprotect(memory, GUARD_SIZE, PROT_NONE);
+	return memory;
+}
+
+static void _releaseCStack(uint8_t* memory) {
+	if (freeCStackCount == MAX_FREE_C_STACKS) {
+		munmap(memory, C_STACK_SIZE);
+		return;
+	}
+	freeCStacks[freeCStackCount++] = memory;
+}
+
+Coroutine* coroutineCreate(ParseNode* function, const Data* args, uint16_t argCount) {
+	Coroutine* coroutine = gcAllocate(OBJECT_COROUTINE, sizeof *coroutine);
+	coroutine->function = function;
+	coroutine->state = STATE_CREATED;
+	ValueStack* stack = &coroutine->stack;
+	stack->capacity = argCount * 2 > INITIAL_VALUES ? argCount * 2 : INITIAL_VALUES;
+	stack->values = memoryAllocate(stack->capacity * sizeof *stack->values, MEMORY_STACKS);
+	gcTrack(stack->capacity * sizeof *stack->values);
+	// Same layout as a function call: arguments in reverse, so parameter 0 is at frameStart - 1
+	for (uint16_t i = 0; i < argCount; ++i) {
+		stack->values[argCount - 1 - i] = args[i];
+		gcBarrier(args[i]);
+	}
+	stack->count = argCount;
+	stack->frameStart = argCount;
+	return coroutine;
+}
+
+static void _freeStacks(Coroutine* coroutine) {
+	gcTrack(-(ssize_t)(coroutine->stack.capacity * sizeof *coroutine->stack.values));
+	memoryFree(coroutine->stack.values);
+	memset(&coroutine->stack, 0, sizeof coroutine->stack);
+	if (coroutine->cStack != NULL) {
+		_releaseCStack(coroutine->cStack);
+		coroutine->cStack = NULL;
+	}
+}
+
+// Called by the collector, a suspended coroutine is simply dropped
+void coroutineFinalize(Coroutine* coroutine) {
+	assert(coroutine->state != STATE_RUNNING);
+	_freeStacks(coroutine);
+}
+
+void coroutineTrace(const Coroutine* coroutine, size_t* work) {
+	++*work;
+	for (size_t i = 0; i < coroutine->stack.count; ++i) {
+		gcShade(coroutine->stack.values[i]);
+	}
+	gcShade(coroutine->transfer);
+	*work += coroutine->stack.count;
+}
+
+// The stacks of the main program and of every coroutine waiting for a resume() to return
+void coroutineMarkRoots(void) {
+	for (const Coroutine* c = current; c != NULL; c = c->resumer) {
+		for (size_t i = 0; i < c->resumerStack.count; ++i) {
+			gcShade(c->resumerStack.values[i]);
+		}
+	}
+}
+
+static void _entry(void) {
+	Coroutine* coroutine = starting;
+	Data result = eval(&coroutine->function->children[2]);
+	if (result.type == TYPE_NONE) {
+		result.type = TYPE_VOID;
+	}
+	gcBarrier(coroutine->transfer);
+	coroutine->transfer = result;
+	coroutine->state = STATE_DONE;
+	_longjmp(coroutine->resumerContext, 1);
+}
+
+static void _start(Coroutine* coroutine) {
+	coroutine->cStack = _acquireCStack();
+	getcontext(&startContext);
+	startContext.uc_stack.ss_sp = coroutine->cStack;
+	startContext.uc_stack.ss_size = C_STACK_SIZE;
+	startContext.uc_link = NULL;
+	makecontext(&startContext, _entry, 0);
+	starting = coroutine;
+	setcontext(&startContext);
+}
+
+// Runs the coroutine until it yields or returns, and returns that value
+// NOTE: Resuming a finished coroutine returns None
+Data coroutineResume(Coroutine* coroutine) {
+	switch (coroutine->state) {
+	case STATE_RUNNING:
+		fprintf(stderr, "Error: Generator is already running\n");
+		exit(EXIT_FAILURE);
+	case STATE_DONE: {
+		Data result = { .type = TYPE_VOID };
+		return result;
+	}
+	}
+	// Its stack is about to become the value stack, which is not traced again
+	gcBarrierResume(coroutine);
+	const uint8_t state = coroutine->state;
+	coroutine->state = STATE_RUNNING;
+	coroutine->resumer = current;
+	coroutine->resumerStack = evalSwapStack(coroutine->stack);
+	memset(&coroutine->stack, 0, sizeof coroutine->stack);
+	current = coroutine;
+	if (_setjmp(coroutine->resumerContext) == 0) {
+		if (state == STATE_CREATED) {
+			_start(coroutine);
+		}
+		_longjmp(coroutine->context, 1);
+	}
+	current = coroutine->resumer;
+	coroutine->stack = evalSwapStack(coroutine->resumerStack);
+	memset(&coroutine->resumerStack, 0, sizeof coroutine->resumerStack);
+	coroutine->resumer = NULL;
+	if (coroutine->state == STATE_DONE) {
+		_freeStacks(coroutine);
+	}
+	else {
+		coroutine->state = STATE_SUSPENDED;
+	}
+	return coroutine->transfer;
+}
+
+void coroutineYield(Data value) {
+	Coroutine* coroutine = current;
+	assert(coroutine != NULL);
+	gcBarrier(coroutine->transfer);
+	coroutine->transfer = value;
+	if (_setjmp(coroutine->context) == 0) {
+		_longjmp(coroutine->resumerContext, 1);
+	}
+}
+
+bool coroutineDone(const Coroutine* coroutine) {
+	return coroutine->state == STATE_DONE;
+}
+
+// The coroutine that is running, NULL for the main program
+Coroutine* coroutineCurrent(void) {
+	return current;
+}
@@ -5,170 +5,197 @@
 #include <string.h>
 #include <assert.h>
 
-#define MAX_GLOBAL_SCOPE_COUNT	16
-#define MAX_SCOPE_COUNT			32
-#define MAX_FUNCTION_COUNT		32
-#define MAX_STACK_COUNT			128
-
-typedef struct Variable	Variable;
-struct Variable {
-	uint64_t	identifier;
-	ssize_t		index;
-};
-
-typedef struct Function	Function;
-struct Function {
-	uint64_t	identifier;
-	ParseNode*	node;
-};
+#define INITIAL_STACK_CAPACITY	128
+#define MAX_STACK_COUNT			(1 << 20)
 
-static Variable globalScope[MAX_GLOBAL_SCOPE_COUNT];
-static size_t globalScopeCount = 0;
-static Variable scope[MAX_SCOPE_COUNT];
-static size_t scopeCount = 0;
-static Function functions[MAX_FUNCTION_COUNT];
-static size_t functionCount = 0;
-static Data stack[MAX_STACK_COUNT];
-static size_t stackCount = 0;
-static size_t frameStart = 0;
+// NOTE:	The running value stack, coroutines swap in their own with evalSwapStack()
+//			Code that holds a pointer into it must not push while using the pointer
+//			Every thread has its own, see evalParallelFor()
+static __thread Data* stack = NULL;
+static __thread size_t stackCount = 0;
+static __thread size_t stackCapacity = 0;
+static __thread size_t frameStart = 0;
+static __thread bool inParallelFor = false;	// Nodes are shared between threads, they cannot be quickened
+static __thread int64_t fuel = INT64_MAX;	// Loop iterations and calls left, see scheduler.c
+static bool reloadRequested = false;	// Set by the thread of watch mode, see evalRequestReload()
+static bool tracing = false;	// See trace.c
 
 static void stackPush(Data d) {
-	assert(stackCount != MAX_STACK_COUNT);
+	if (stackCount == stackCapacity) {
+		if (stackCount == MAX_STACK_COUNT) {
+			fprintf(stderr, "Error: Stack overflow\n");
+			exit(EXIT_FAILURE);
+		}
+		const size_t newCapacity = stackCapacity == 0 ? INITIAL_STACK_CAPACITY : stackCapacity * 2;
+		stack = memoryReallocate(stack, newCapacity * sizeof *stack, MEMORY_STACKS);
+		gcTrack((newCapacity - stackCapacity) * sizeof *stack);
+		stackCapacity = newCapacity;
+	}
 	stack[stackCount++] = d;
 }
 
-static void declare(ParseNode* identifier) {
-	assert(scopeCount != MAX_SCOPE_COUNT);
-	identifier->syntax = RUNTIME_KNOWN_VARIABLE;
-	scope[scopeCount].identifier = identifier->data.identifier;
-	scope[scopeCount].index = stackCount - frameStart;
-	++scopeCount;
+ValueStack evalSwapStack(ValueStack next) {
+	ValueStack previous = {
+		.values = stack,
+		.count = stackCount,
+		.capacity = stackCapacity,
+		.frameStart = frameStart,
+	};
+	stack = next.values;
+	stackCount = next.count;
+	stackCapacity = next.capacity;
+	frameStart = next.frameStart;
+	return previous;
 }
 
-static void lookupVariable(ParseNode* identifier) {
-	for (ssize_t i = scopeCount - 1; i >= 0; --i) {
-		if (scope[i].identifier == identifier->data.identifier) {
-			identifier->syntax = RUNTIME_KNOWN_VARIABLE;
-			identifier->stackIndex = scope[i].index;
-			return;
-		}
-	}
-	for (ssize_t i = globalScopeCount - 1; i >= 0; --i) {
-		if (globalScope[i].identifier == identifier->data.identifier) {
-			identifier->syntax = RUNTIME_KNOWN_GLOBAL_VARIABLE;
-			identifier->stackIndex = globalScope[i].index;
-			return;
-		}
+int64_t evalFuel(void) {
+	return fuel;
+}
+
+void evalSetFuel(int64_t units) {
+	fuel = units;
+}
+
+void evalSetTracing(bool enabled) {
+	tracing = enabled;
+}
+
+// The main thread keeps burning during a 'parallel for' but only asks for more once the loop is over
+__attribute__((noinline)) static void _outOfFuel(void) {
+	if (!inParallelFor) {
+		schedulerOutOfFuel();
 	}
-	fprintf(stderr, "Error: Variable not in scope\n");
-	exit(EXIT_FAILURE);
 }
 
-static Data stdPrint(const ParseNode* argList) {
-	Data result = {};
-	for (uint16_t i = 0; i < argList->childCount; ++i) {
-		if (i > 0) {
-			putchar(' ');
-		}
-		Data arg = eval(&argList->children[i]);
-		switch (arg.type) {
-		case TYPE_INTEGER:
-			printf("%li", arg.integer);
-			break;
-		case TYPE_STRING:
-			printf("%s", arg.string);
-			break;
-		case TYPE_VOID:
-		case TYPE_NONE:
-		default:
-			printf("None");
-			break;
-		}
+// Counts a loop iteration or a call
+static inline void _burn(void) {
+	if (--fuel <= 0) {
+		_outOfFuel();
 	}
-	putchar('\n');
-	return result;
 }
 
-static void lookupFunction(ParseNode* functionCall) {
-	const uint64_t identifier = functionCall->children[0].data.identifier;
-	switch (identifier) {
-	case 0x746e697270:
-		functionCall->syntax = RUNTIME_STANDARD_FUNCTION;
-		return;
+// May be called from any thread, the program is reloaded by the next function call outside of a 'parallel for'
+void evalRequestReload(void) {
+	__atomic_store_n(&reloadRequested, true, __ATOMIC_RELAXED);
+}
+
+void evalMarkRoots(void) {
+	for (size_t i = 0; i < stackCount; ++i) {
+		gcShade(stack[i]);
 	}
-	for (size_t i = 0; i < functionCount; ++i) {
-		if (functions[i].identifier == functionCall->children[0].data.identifier) {
-			functionCall->syntax = RUNTIME_KNOWN_FUNCTION;
-			functionCall->function = functions[i].node;
-			return;
-		}
+}
+
+static Map* _expectMap(Data d) {
+	if (d.type != TYPE_MAP) {
+		fprintf(stderr, "Error: Expected a map\n");
+		exit(EXIT_FAILURE);
 	}
-	fprintf(stderr, "Error: Function not found\n");
-	exit(EXIT_FAILURE);
+	return d.map;
 }
 
 static Data functionCall(ParseNode* functionCall) {
 	const ParseNode* argList = &functionCall->children[1];
-	for (int8_t i = argList->childCount - 1; i >= 0; --i) {
+	const size_t savedStackCount = stackCount;
+	for (uint32_t i = argList->childCount; i-- != 0;) {
 		stackPush(eval(&argList->children[i]));
 	}
-	const ParseNode* function = functionCall->function;
-	const ParseNode* paramList = &function->children[1];
-	for (uint16_t i = 0; i < paramList->childCount; ++i) {
-		assert(scopeCount != MAX_SCOPE_COUNT);
-		scope[scopeCount].identifier = paramList->children[i].data.identifier;
-		scope[scopeCount].index = -(ssize_t)(i + 1);
-		++scopeCount;
+	_burn();
+	if (__atomic_load_n(&reloadRequested, __ATOMIC_RELAXED) && !inParallelFor) {
+		__atomic_store_n(&reloadRequested, false, __ATOMIC_RELAXED);
+		watchReload();
 	}
 	const size_t savedFrameStart = frameStart;
 	frameStart = stackCount;
-	Data result = eval(&function->children[2]);
-	scopeCount -= (size_t)paramList->childCount;
-	stackCount = frameStart;
+	if (tracing) {
+		traceEnter(functionCall->function->children[0].data.identifier);
+	}
+	Data result = eval(&functionCall->function->children[2]);
+	if (tracing) {
+		traceExit();
+	}
+	// The arguments are popped too, resolveProgram() assumes a call leaves the stack as it was
+	stackCount = savedStackCount;
 	frameStart = savedFrameStart;
 	return result;
 }
 
-static Data stdFunctionCall(const ParseNode* functionCall) {
-	const uint64_t identifier = functionCall->children[0].data.identifier;
-	const ParseNode* argList = &functionCall->children[1];
-	switch (identifier) {
-	case 0x746e697270:
-		return stdPrint(argList);
-	default:
-		fprintf(stderr, "Error: Unknown standard function\n");
-		exit(EXIT_FAILURE);
+// Like functionCall() without a frame of its own: the returned expression reads the arguments as parameters
+static Data inlinedCall(const ParseNode* inlinedCall) {
+	const ParseNode* argList = &inlinedCall->children[0];
+	const size_t savedStackCount = stackCount;
+	for (uint32_t i = argList->childCount; i-- != 0;) {
+		stackPush(eval(&argList->children[i]));
 	}
+	const size_t savedFrameStart = frameStart;
+	frameStart = stackCount;
+	const Data result = eval(&inlinedCall->children[1]);
+	stackCount = savedStackCount;
+	frameStart = savedFrameStart;
+	return result;
 }
 
-static Data evalProgram(ParseNode* node) {
-	Data result = {};
-	for (int32_t i = 0; i < node->childCount; ++i) {
+// The arguments are evaluated on the caller's stack and copied to the stack of the new coroutine
+static Data generatorCall(ParseNode* generatorCall) {
+	const ParseNode* argList = &generatorCall->children[1];
+	const size_t savedStackCount = stackCount;
+	for (uint32_t i = 0; i < argList->childCount; ++i) {
+		stackPush(eval(&argList->children[i]));
+	}
+	Data result = { .type = TYPE_COROUTINE };
+	result.coroutine = coroutineCreate(generatorCall->function, &stack[savedStackCount], argList->childCount);
+	stackCount = savedStackCount;
+	return result;
+}
+
+// The arguments stay on the stack during the call, so they are roots for the collector
+static Data nativeCall(const ParseNode* nativeCall) {
+	const ParseNode* argList = &nativeCall->children[1];
+	const size_t savedStackCount = stackCount;
+	for (uint32_t i = 0; i < argList->childCount; ++i) {
+		stackPush(eval(&argList->children[i]));
+	}
+	const Data result = nativeCall->native->function(&stack[savedStackCount], argList->childCount);
+	stackCount = savedStackCount;
+	return result;
+}
+
+// Function calls used as statements discard their result, anything else that is not TYPE_NONE is a return
+static Data _evalStatement(ParseNode* node) {
+	Data result = eval(node);
+	switch (node->syntax) {
+	case RUNTIME_KNOWN_FUNCTION:
+	case RUNTIME_GENERATOR_CALL:
+	case RUNTIME_NATIVE_FUNCTION:
+		result.type = TYPE_NONE;
+		break;
+	}
+	return result;
+}
+
+// NOTE:	Global declarations are kept in the tree (instead of removed after running them) because
+//			RUNTIME_KNOWN_FUNCTION nodes point at their function node among the same children
+//			The fork server runs the two halves of a program in different processes, see server.c
+void evalGlobals(ParseNode* node) {
+	for (uint32_t i = 0; i < node->childCount; ++i) {
 		if (node->children[i].syntax == SYNTAX_DECLARATION) {
-			assert(globalScopeCount < MAX_GLOBAL_SCOPE_COUNT);
 			const ParseNode* declaration = &node->children[i];
-			globalScope[globalScopeCount].identifier = declaration->children[0].data.identifier;
-			globalScope[globalScopeCount].index = stackCount;
-			++globalScopeCount;
+			assert(declaration->children[0].stackIndex == (ssize_t)stackCount);
 			Data initialValue = {};
 			if (declaration->childCount == 2) {
 				initialValue = eval(&declaration->children[1]);
 			}
 			stackPush(initialValue);
-			parseNodeRemoveChild(node, i--);
-		}
-		else if (node->children[i].syntax == SYNTAX_FUNCTION) {
-			// TODO: For functions we can check whether arguments have duplicate names e.g. fn add(a, a)
-			// 		Or just do it when parsing
-			assert(functionCount < MAX_FUNCTION_COUNT);
-			ParseNode* function = &node->children[i];
-			functions[functionCount].identifier = function->children[0].data.identifier;
-			functions[functionCount].node = function;
-			++functionCount;
 		}
 	}
-	for (uint16_t i = 0; i < node->childCount; ++i) {
-		result = eval(&node->children[i]);
+}
+
+Data evalStatements(ParseNode* node) {
+	Data result = {};
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		if (node->children[i].syntax == SYNTAX_DECLARATION) {
+			continue;
+		}
+		result = _evalStatement(&node->children[i]);
 		if (result.type != TYPE_NONE) {
 			return result;
 		}
@@ -176,23 +203,518 @@ static Data evalProgram(ParseNode* node) {
 	return result;
 }
 
+static Data evalProgram(ParseNode* node) {
+	evalGlobals(node);
+	return evalStatements(node);
+}
+
+// Whether the operands of an '==' or '!=' node are equal, strings compare by contents
+static bool _equal(ParseNode* node) {
+	const size_t savedStackCount = stackCount;
+	stackPush(eval(&node->children[0]));
+	const Data b = eval(&node->children[1]);
+	const Data a = stack[savedStackCount];
+	stackCount = savedStackCount;
+	if (a.type != b.type) {
+		return false;
+	}
+	switch (a.type) {
+	case TYPE_STRING:
+		return strcmp(a.string, b.string) == 0;
+	case TYPE_MAP:
+		return a.map == b.map;
+	case TYPE_BIGINT:
+		return bigintCompare(a, b) == 0;
+	case TYPE_NONE:
+	case TYPE_VOID:
+		return true;
+	default:
+		return a.integer == b.integer;
+	}
+}
+
+// NOTE:	Integer results that do not fit in an int64_t cannot be returned by evalInteger()
+//			It then pushes the Bigint, sets 'promoted' and returns 0, every caller has to check
+static __thread bool promoted = false;
+
+static int64_t evalInteger(ParseNode* node);
+
+static int64_t _promote(Data d) {
+	if (d.type != TYPE_BIGINT) {
+		fprintf(stderr, "Error: Expected an integer operand\n");
+		exit(EXIT_FAILURE);
+	}
+	stackPush(d);
+	promoted = true;
+	return 0;
+}
+
+static Data _integer(int64_t value) {
+	Data result = { .type = TYPE_INTEGER, .integer = value };
+	return result;
+}
+
+static int64_t _small(Data d) {
+	if (d.type == TYPE_INTEGER) {
+		return d.integer;
+	}
+	return _promote(d);
+}
+
+static int64_t _checkedInteger(ParseNode* node) {
+	if (node->inferred == INFERRED_INTEGER) {
+		return evalInteger(node);
+	}
+	return _small(eval(node));
+}
+
+static bool _truthy(ParseNode* node) {
+	if (node->inferred == INFERRED_INTEGER) {
+		const int64_t value = evalInteger(node);
+		if (promoted) {
+			// Bigints are never 0
+			promoted = false;
+			--stackCount;
+			return true;
+		}
+		return value != 0;
+	}
+	// Non-integers are true unless they are None
+	const Data d = eval(node);
+	switch (d.type) {
+	case TYPE_INTEGER:
+		return d.integer != 0;
+	case TYPE_NONE:
+	case TYPE_VOID:
+		return false;
+	default:
+		return true;
+	}
+}
+
+// NOTE:	Slow paths of binary operators, kept out of evalInteger() so that its frame stays small
+//			Operands are not used after bigintArithmetic() allocates, so only pending ones need to be on the stack
+__attribute__((noinline)) static int64_t _bigBinary(Syntax operator, Data a, Data b) {
+	return _small(bigintArithmetic(operator, a, b));
+}
+
+// The left operand was promoted and stays on the stack while the right one is evaluated
+__attribute__((noinline)) static int64_t _bigLeft(ParseNode* node) {
+	promoted = false;
+	const Data b = eval(&node->children[1]);
+	const Data a = stack[--stackCount];
+	return _bigBinary(node->syntax, a, b);
+}
+
+__attribute__((noinline)) static int64_t _bigRight(Syntax operator, int64_t a) {
+	promoted = false;
+	return _bigBinary(operator, _integer(a), stack[--stackCount]);
+}
+
+// Results that do not fit in an int64_t are promoted
+static int64_t _binary(Syntax operator, int64_t a, int64_t b) {
+	int64_t result;
+	switch (operator) {
+	case TOKEN_PLUS:
+		if (__builtin_add_overflow(a, b, &result)) {
+			break;
+		}
+		return result;
+	case TOKEN_MINUS:
+		if (__builtin_sub_overflow(a, b, &result)) {
+			break;
+		}
+		return result;
+	case TOKEN_MULTIPLY:
+		if (__builtin_mul_overflow(a, b, &result)) {
+			break;
+		}
+		return result;
+	case TOKEN_DIVIDE:
+		if (b == 0) {
+			fprintf(stderr, "Error: Division by zero\n");
+			exit(EXIT_FAILURE);
+		}
+		if (a == INT64_MIN && b == -1) {
+			break;
+		}
+		return a / b;
+	case TOKEN_EQUAL:
+		return a == b;
+	case TOKEN_NOT_EQUAL:
+		return a != b;
+	case TOKEN_GREATER:
+		return a > b;
+	case TOKEN_LESS:
+		return a < b;
+	case TOKEN_GREATER_EQUAL:
+		return a >= b;
+	case TOKEN_LESS_EQUAL:
+	default:
+		return a <= b;
+	}
+	return _bigBinary(operator, _integer(a), _integer(b));
+}
+
+// NOTE:	Quickening rewrites a node the first time it runs into a variant that reads its operands straight
+//			from the stack or the literal, like resolveProgram() does for names
+//			- Only operands proven to be integers qualify, the variants only check for Bigints and overflow
+//			- 'generic' keeps the original syntax, and marks nodes that were tried and left as they are
+static bool quicken(ParseNode* node) {
+	if (node->generic != SYNTAX_NONE || inParallelFor) {
+		return false;
+	}
+	node->generic = node->syntax;
+	const ParseNode* a = &node->children[0];
+	const ParseNode* b = &node->children[1];
+	if (a->inferred != INFERRED_INTEGER || b->inferred != INFERRED_INTEGER) {
+		return false;
+	}
+	if (a->syntax == RUNTIME_KNOWN_VARIABLE && b->syntax == TOKEN_INTEGER) {
+		node->syntax = RUNTIME_LOCAL_OP_CONST;
+	}
+	else if (a->syntax == RUNTIME_KNOWN_VARIABLE && b->syntax == RUNTIME_KNOWN_VARIABLE) {
+		node->syntax = RUNTIME_LOCAL_OP_LOCAL;
+	}
+	else if (a->syntax == RUNTIME_KNOWN_GLOBAL_VARIABLE && b->syntax == TOKEN_INTEGER) {
+		node->syntax = RUNTIME_GLOBAL_OP_CONST;
+	}
+	return node->syntax != node->generic;
+}
+
+// Undoes inference and quickening after the program was changed (see watch.c), nodes are not quickened again
+void evalForgetTypes(ParseNode* node) {
+	node->inferred = INFERRED_UNKNOWN;
+	if (node->generic != SYNTAX_NONE) {
+		node->syntax = node->generic;
+	}
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		evalForgetTypes(&node->children[i]);
+	}
+}
+
+// Fuses 'x = x + c' and 'x = x - c' into one node when x is proven to be an integer
+static bool quickenAssignment(ParseNode* node) {
+	if (node->generic != SYNTAX_NONE || inParallelFor) {
+		return false;
+	}
+	node->generic = node->syntax;
+	const ParseNode* variable = &node->children[0];
+	const ParseNode* sum = &node->children[1];
+	if (variable->inferred != INFERRED_INTEGER || (sum->syntax != TOKEN_PLUS && sum->syntax != TOKEN_MINUS)
+		|| sum->children[1].syntax != TOKEN_INTEGER || sum->children[0].syntax != variable->syntax
+		|| sum->children[0].stackIndex != variable->stackIndex) {
+		return false;
+	}
+	const int64_t step = sum->children[1].data.integerLiteral;
+	node->data.integerLiteral = sum->syntax == TOKEN_PLUS ? step : -step;
+	node->syntax = variable->syntax == RUNTIME_KNOWN_VARIABLE ? RUNTIME_INCREMENT_LOCAL : RUNTIME_INCREMENT_GLOBAL;
+	return true;
+}
+
+// NOTE:	Untagged evaluation, only valid for nodes with inferred == INFERRED_INTEGER
+//			Operands that are not proven integers go through _checkedInteger()
+static int64_t evalInteger(ParseNode* node) {
+	switch (node->syntax) {
+	case TOKEN_INTEGER:
+		return node->data.integerLiteral;
+	case RUNTIME_KNOWN_VARIABLE:
+		return _small(stack[(ssize_t)frameStart + node->stackIndex]);
+	case RUNTIME_KNOWN_GLOBAL_VARIABLE:
+		return _small(stack[node->stackIndex]);
+	case TOKEN_EQUAL:
+	case TOKEN_NOT_EQUAL:
+		// The result is an integer whatever the operands are, strings compare by contents
+		if (node->children[0].inferred != INFERRED_INTEGER || node->children[1].inferred != INFERRED_INTEGER) {
+			return _equal(node) == (node->syntax == TOKEN_EQUAL);
+		}
+		__attribute__((fallthrough));
+	case TOKEN_PLUS:
+	case TOKEN_MINUS:
+	case TOKEN_MULTIPLY:
+	case TOKEN_DIVIDE:
+	case TOKEN_GREATER:
+	case TOKEN_LESS:
+	case TOKEN_GREATER_EQUAL:
+	case TOKEN_LESS_EQUAL: {
+		if (quicken(node)) {
+			return evalInteger(node);
+		}
+		const int64_t a = _checkedInteger(&node->children[0]);
+		if (promoted) {
+			return _bigLeft(node);
+		}
+		const int64_t b = _checkedInteger(&node->children[1]);
+		if (promoted) {
+			return _bigRight(node->syntax, a);
+		}
+		return _binary(node->syntax, a, b);
+	}
+	case RUNTIME_LOCAL_OP_CONST: {
+		const Data a = stack[(ssize_t)frameStart + node->children[0].stackIndex];
+		const int64_t b = node->children[1].data.integerLiteral;
+		if (a.type != TYPE_INTEGER) {
+			return _bigBinary(node->generic, a, _integer(b));
+		}
+		return _binary(node->generic, a.integer, b);
+	}
+	case RUNTIME_LOCAL_OP_LOCAL: {
+		const Data a = stack[(ssize_t)frameStart + node->children[0].stackIndex];
+		const Data b = stack[(ssize_t)frameStart + node->children[1].stackIndex];
+		if (a.type != TYPE_INTEGER || b.type != TYPE_INTEGER) {
+			return _bigBinary(node->generic, a, b);
+		}
+		return _binary(node->generic, a.integer, b.integer);
+	}
+	case RUNTIME_GLOBAL_OP_CONST: {
+		const Data a = stack[node->children[0].stackIndex];
+		const int64_t b = node->children[1].data.integerLiteral;
+		if (a.type != TYPE_INTEGER) {
+			return _bigBinary(node->generic, a, _integer(b));
+		}
+		return _binary(node->generic, a.integer, b);
+	}
+	// Operands after the first one that decides the result are not evaluated
+	case TOKEN_AND:
+		for (uint32_t i = 0; i < node->childCount; ++i) {
+			if (!_truthy(&node->children[i])) {
+				return 0;
+			}
+		}
+		return 1;
+	case TOKEN_OR:
+		for (uint32_t i = 0; i < node->childCount; ++i) {
+			if (_truthy(&node->children[i])) {
+				return 1;
+			}
+		}
+		return 0;
+	case TOKEN_NOT:
+		return !_truthy(&node->children[0]);
+	default:
+		// Calls and other nodes that were proven to produce integers
+		return _small(eval(node));
+	}
+}
+
 static Data evalBlock(const ParseNode* node) {
 	Data result = {};
 	const size_t savedStackCount = stackCount;
-	const size_t savedScopeCount = scopeCount;
-	for (uint16_t i = 0; i < node->childCount; ++i) {
-		result = eval(&node->children[i]);
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		result = _evalStatement(&node->children[i]);
 		if (result.type != TYPE_NONE) {
 			break;
 		}
 	}
 	stackCount = savedStackCount;
-	scopeCount = savedScopeCount;
+	return result;
+}
+
+// NOTE:	Fast path for loops found by analyzeCountedLoop() and for 'for' loops
+//			- The counter lives in a C variable and is written to its slot before each iteration
+//			- The bound was proven invariant, so it is evaluated once
+//			- The first 'statementCount' statements of 'body' run without a nested evalBlock()
+//			- If the counter overflows it is stored as a Bigint and the loop stops, see evalCountedWhile()
+static Data evalCountedLoop(size_t slot, Syntax comparison, int64_t bound, int64_t step,
+	const ParseNode* body, uint32_t statementCount) {
+	Data result = {};
+	const size_t savedStackCount = stackCount;
+	int64_t i = stack[slot].integer;
+	while (_binary(comparison, i, bound)) {
+		stack[slot].integer = i;
+		for (uint32_t j = 0; j < statementCount; ++j) {
+			result = _evalStatement(&body->children[j]);
+			if (result.type != TYPE_NONE) {
+				stackCount = savedStackCount;
+				return result;
+			}
+		}
+		stackCount = savedStackCount;
+		_burn();
+		if (__builtin_add_overflow(i, step, &i)) {
+			stack[slot] = bigintArithmetic(TOKEN_PLUS, _integer(stack[slot].integer), _integer(step));
+			return result;
+		}
+	}
+	stack[slot].integer = i;
+	return result;
+}
+
+static Data evalWhile(ParseNode* node) {
+	Data result = {};
+	while (_truthy(&node->children[0])) {
+		result = eval(&node->children[1]);
+		if (result.type != TYPE_NONE) {
+			return result;
+		}
+		_burn();
+	}
+	return result;
+}
+
+static size_t _slot(const ParseNode* variable) {
+	if (variable->syntax == RUNTIME_KNOWN_GLOBAL_VARIABLE) {
+		return variable->stackIndex;
+	}
+	return (ssize_t)frameStart + variable->stackIndex;
+}
+
+static Data evalCountedWhile(ParseNode* node) {
+	const ParseNode* condition = &node->children[0];
+	const ParseNode* body = &node->children[1];
+	const size_t slot = _slot(&condition->children[0]);
+	const Data bound = eval(&condition->children[1]);
+	if (stack[slot].type != TYPE_INTEGER || bound.type != TYPE_INTEGER) {
+		return evalWhile(node);
+	}
+	// The final statement is the increment, which evalCountedLoop() does natively
+	// The condition may have been quickened by an earlier evalWhile() fallback
+	const Syntax comparison = condition->generic != SYNTAX_NONE ? condition->generic : condition->syntax;
+	const Data result = evalCountedLoop(slot, comparison, bound.integer, node->data.integerLiteral,
+		body, body->childCount - 1);
+	if (result.type == TYPE_NONE && stack[slot].type == TYPE_BIGINT) {
+		return evalWhile(node);
+	}
+	return result;
+}
+
+// The body runs in batches of iterations that bench.c times
+static Data evalBench(ParseNode* node) {
+	Bench bench;
+	benchStart(&bench);
+	for (uint64_t batch = benchNext(&bench); batch != 0; batch = benchNext(&bench)) {
+		for (uint64_t i = 0; i < batch; ++i) {
+			const Data result = eval(&node->children[1]);
+			if (result.type != TYPE_NONE) {
+				return result;
+			}
+			_burn();
+		}
+	}
+	benchReport(&bench, node->children[0].data.stringLiteral);
+	const Data result = {};
+	return result;
+}
+
+// Loops are timed as a whole, only long ones are recorded
+__attribute__((noinline)) static Data _tracedWhile(ParseNode* node) {
+	const uint64_t begin = traceLoopBegin();
+	const Data result = node->syntax == SYNTAX_WHILE ? evalWhile(node) : evalCountedWhile(node);
+	traceLoopEnd(begin);
+	return result;
+}
+
+static Data evalFor(ParseNode* node) {
+	const Data first = eval(&node->children[1]);
+	const Data last = eval(&node->children[2]);
+	if (first.type != TYPE_INTEGER || last.type != TYPE_INTEGER) {
+		fprintf(stderr, "Error: Bounds of 'for' must be integers\n");
+		exit(EXIT_FAILURE);
+	}
+	const size_t slot = stackCount;
+	stackPush(first);
+	const ParseNode* body = &node->children[3];
+	Data result = evalCountedLoop(slot, TOKEN_LESS_EQUAL, last.integer, 1, body, body->childCount);
+	stackCount = slot;
+	return result;
+}
+
+// NOTE:	Iterations of 'parallel for' are spread over the threads with poolFor()
+//			- Every thread copies the value stack as it was when the loop started, resolveProgram() made sure
+//			  that the body only changes its own locals and the reduction variables
+//			- Reduction variables start at 0 in every copy and are summed into the real ones after the loop
+//			- The first iteration runs alone, so the nodes are quickened before they are shared
+//			- The collector is paused meanwhile, the copies are not roots
+typedef struct ParallelFor	ParallelFor;
+struct ParallelFor {
+	const ParseNode*	body;
+	const Data*			values;
+	size_t				count;
+	size_t				frameStart;
+	size_t				slot;
+	const size_t*		reductions;
+	uint16_t			reductionCount;
+	ValueStack*			stacks;	// Per worker, copied when it runs its first range
+};
+
+static void _parallelRange(void* context, size_t worker, int64_t first, int64_t last) {
+	ParallelFor* loop = context;
+	ValueStack* own = &loop->stacks[worker];
+	if (own->values == NULL) {
+		own->capacity = loop->count < INITIAL_STACK_CAPACITY ? INITIAL_STACK_CAPACITY : loop->count * 2;
+		own->values = memoryAllocate(own->capacity * sizeof *own->values, MEMORY_STACKS);
+		gcTrack(own->capacity * sizeof *own->values);
+		memcpy(own->values, loop->values, loop->count * sizeof *own->values);
+		own->count = loop->count;
+		own->frameStart = loop->frameStart;
+		for (uint32_t i = 0; i < loop->reductionCount; ++i) {
+			own->values[loop->reductions[i]] = _integer(0);
+		}
+	}
+	const ValueStack previous = evalSwapStack(*own);
+	const bool wasInParallelFor = inParallelFor;
+	inParallelFor = true;
+	stack[loop->slot] = _integer(first);
+	evalCountedLoop(loop->slot, TOKEN_LESS, last, 1, loop->body, loop->body->childCount);
+	inParallelFor = wasInParallelFor;
+	*own = evalSwapStack(previous);
+}
+
+// Kept out of eval(), its frame would limit the recursion depth
+__attribute__((noinline)) static Data evalParallelFor(ParseNode* node) {
+	const Data first = eval(&node->children[1]);
+	const Data last = eval(&node->children[2]);
+	if (first.type != TYPE_INTEGER || last.type != TYPE_INTEGER) {
+		fprintf(stderr, "Error: Bounds of 'for' must be integers\n");
+		exit(EXIT_FAILURE);
+	}
+	const size_t threads = poolThreadCount();
+	if (inParallelFor || threads == 1 || first.integer >= last.integer || last.integer == INT64_MAX) {
+		return evalFor(node);
+	}
+	const size_t slot = stackCount;
+	stackPush(first);
+	const ParseNode* body = &node->children[3];
+	evalCountedLoop(slot, TOKEN_LESS_EQUAL, first.integer, 1, body, body->childCount);
+
+	const ParseNode* variables = &node->children[4];
+	size_t reductions[variables->childCount + 1];
+	for (uint32_t i = 0; i < variables->childCount; ++i) {
+		reductions[i] = _slot(&variables->children[i]);
+	}
+	ValueStack stacks[threads];
+	memset(stacks, 0, sizeof stacks);
+	ParallelFor loop = {
+		.body = body,
+		.values = stack,
+		.count = stackCount,
+		.frameStart = frameStart,
+		.slot = slot,
+		.reductions = reductions,
+		.reductionCount = variables->childCount,
+		.stacks = stacks,
+	};
+	gcPause(true);
+	poolFor(_parallelRange, &loop, first.integer + 1, last.integer + 1);
+	for (size_t i = 0; i < threads; ++i) {
+		if (stacks[i].values == NULL) {
+			continue;
+		}
+		for (uint32_t j = 0; j < loop.reductionCount; ++j) {
+			const size_t r = reductions[j];
+			stack[r] = bigintArithmetic(TOKEN_PLUS, stack[r], stacks[i].values[r]);
+		}
+		gcTrack(-(ssize_t)(stacks[i].capacity * sizeof *stacks[i].values));
+		memoryFree(stacks[i].values);
+	}
+	gcPause(false);
+	stackCount = slot;
+	Data result = {};
 	return result;
 }
 
 // NOTE:	When an identifier is on the left of an assignment, we do not eval() it.
-// NOTE:	When we eval() a function definition we just register its name.
+// NOTE:	When we eval() a function definition or an import nothing happens, names are bound by resolveProgram().
 //			The body is evaluated when the function is called.
 Data eval(ParseNode* node) {
 	Data result = { .type = TYPE_NONE };
@@ -205,23 +727,51 @@ Data eval(ParseNode* node) {
 		if (node->childCount == 2) {
 			result = eval(&node->children[1]);
 		}
-		if (node->children[0].syntax == TOKEN_IDENTIFIER) {
-			declare(&node->children[0]);
-		}
 		stackPush(result);
 		result.type = TYPE_NONE;
 		return result;
 	case SYNTAX_FUNCTION:
+	case SYNTAX_IMPORT:
 		return result;
-	case SYNTAX_ASSIGNMENT:
-		if (node->children[0].syntax == TOKEN_IDENTIFIER) {
-			lookupVariable(&node->children[0]);
+	case SYNTAX_ASSIGNMENT: {
+		if (quickenAssignment(node)) {
+			return eval(node);
 		}
-		stack[(ssize_t)frameStart + node->children[0].stackIndex] = eval(&node->children[1]);
+		const Data value = eval(&node->children[1]);
+		stack[_slot(&node->children[0])] = value;
 		return result;
-	case TOKEN_IDENTIFIER:
-		lookupVariable(node);
-		__attribute__((fallthrough));
+	}
+	case RUNTIME_INCREMENT_LOCAL:
+	case RUNTIME_INCREMENT_GLOBAL: {
+		Data* variable = &stack[_slot(&node->children[0])];
+		int64_t sum;
+		if (variable->type == TYPE_INTEGER
+			&& !__builtin_add_overflow(variable->integer, node->data.integerLiteral, &sum)) {
+			variable->integer = sum;
+		}
+		else {
+			*variable = bigintArithmetic(TOKEN_PLUS, *variable, _integer(node->data.integerLiteral));
+		}
+		return result;
+	}
+	case SYNTAX_INDEX_ASSIGNMENT: {
+		// The map and key stay on the stack so that the collector can see them while the value is evaluated
+		const size_t savedStackCount = stackCount;
+		stackPush(eval(&node->children[0]));
+		stackPush(eval(&node->children[1]));
+		const Data value = eval(&node->children[2]);
+		mapSet(_expectMap(stack[savedStackCount]), stack[savedStackCount + 1], value);
+		stackCount = savedStackCount;
+		return result;
+	}
+	case SYNTAX_INDEX: {
+		const size_t savedStackCount = stackCount;
+		stackPush(eval(&node->children[0]));
+		const Data key = eval(&node->children[1]);
+		result = mapGet(_expectMap(stack[savedStackCount]), key);
+		stackCount = savedStackCount;
+		return result;
+	}
 	case RUNTIME_KNOWN_VARIABLE:
 		return stack[(ssize_t)frameStart + node->stackIndex];
 	case RUNTIME_KNOWN_GLOBAL_VARIABLE:
@@ -233,16 +783,25 @@ Data eval(ParseNode* node) {
 		}
 		result.type = TYPE_VOID;
 		return result;
-	case SYNTAX_FUNCTION_CALL:
-		lookupFunction(node);
-		return eval(node);
 	case RUNTIME_KNOWN_FUNCTION:
 		return functionCall(node);
-	case RUNTIME_STANDARD_FUNCTION:
-		return stdFunctionCall(node);
+	case RUNTIME_GENERATOR_CALL:
+		return generatorCall(node);
+	case RUNTIME_INLINED_CALL:
+		return inlinedCall(node);
+	case SYNTAX_YIELD: {
+		// The value stays on the stack while the coroutine is suspended
+		const size_t savedStackCount = stackCount;
+		stackPush(eval(&node->children[0]));
+		coroutineYield(stack[savedStackCount]);
+		stackCount = savedStackCount;
+		return result;
+	}
+	case RUNTIME_NATIVE_FUNCTION:
+		return nativeCall(node);
 	case SYNTAX_IF:
-		for (uint16_t i = 0; i < node->childCount - 1; i += 2) {
-			if (eval(&node->children[i]).integer) {
+		for (uint32_t i = 0; i < node->childCount - 1; i += 2) {
+			if (_truthy(&node->children[i])) {
 				return eval(&node->children[i + 1]);
 			}
 		}
@@ -252,13 +811,21 @@ Data eval(ParseNode* node) {
 		}
 		return result;
 	case SYNTAX_WHILE:
-		while (eval(&node->children[0]).integer) {
-			result = eval(&node->children[1]);
-			if (result.type != TYPE_NONE) {
-				return result;
-			}
+		if (tracing) {
+			return _tracedWhile(node);
 		}
-		return result;
+		return evalWhile(node);
+	case RUNTIME_COUNTED_WHILE:
+		if (tracing) {
+			return _tracedWhile(node);
+		}
+		return evalCountedWhile(node);
+	case SYNTAX_FOR:
+		return evalFor(node);
+	case SYNTAX_PARALLEL_FOR:
+		return evalParallelFor(node);
+	case SYNTAX_BENCH:
+		return evalBench(node);
 	case TOKEN_INTEGER:
 		result.type = TYPE_INTEGER;
 		result.integer = node->data.integerLiteral;
@@ -267,49 +834,34 @@ Data eval(ParseNode* node) {
 		result.type = TYPE_STRING;
 		result.string = node->data.stringLiteral;
 		return result;
+	case TOKEN_EQUAL:
+	case TOKEN_NOT_EQUAL:
+		if (node->children[0].inferred != INFERRED_INTEGER || node->children[1].inferred != INFERRED_INTEGER) {
+			result.type = TYPE_INTEGER;
+			result.integer = _equal(node) == (node->syntax == TOKEN_EQUAL);
+			return result;
+		}
+		__attribute__((fallthrough));
 	case TOKEN_PLUS:
-		result.type = TYPE_INTEGER;
-		result.integer = eval(&node->children[0]).integer + eval(&node->children[1]).integer;
-		return result;
 	case TOKEN_MINUS:
-		result.type = TYPE_INTEGER;
-		result.integer = eval(&node->children[0]).integer - eval(&node->children[1]).integer;
-		return result;
 	case TOKEN_MULTIPLY:
-		result.type = TYPE_INTEGER;
-		result.integer = eval(&node->children[0]).integer * eval(&node->children[1]).integer;
-		return result;
 	case TOKEN_DIVIDE:
-		result.type = TYPE_INTEGER;
-		result.integer = eval(&node->children[0]).integer / eval(&node->children[1]).integer;
-		return result;
-	case TOKEN_EQUAL:
-		result.type = TYPE_INTEGER;
-		result.integer = eval(&node->children[0]).integer == eval(&node->children[1]).integer;
-		return result;
-	case TOKEN_NOT_EQUAL:
-		result.type = TYPE_INTEGER;
-		result.integer = eval(&node->children[0]).integer != eval(&node->children[1]).integer;
-		return result;
 	case TOKEN_GREATER:
-		result.type = TYPE_INTEGER;
-		result.integer = eval(&node->children[0]).integer > eval(&node->children[1]).integer;
-		return result;
 	case TOKEN_LESS:
-		result.type = TYPE_INTEGER;
-		result.integer = eval(&node->children[0]).integer < eval(&node->children[1]).integer;
-		return result;
 	case TOKEN_GREATER_EQUAL:
-		result.type = TYPE_INTEGER;
-		result.integer = eval(&node->children[0]).integer >= eval(&node->children[1]).integer;
-		return result;
 	case TOKEN_LESS_EQUAL:
-		result.type = TYPE_INTEGER;
-		result.integer = eval(&node->children[0]).integer <= eval(&node->children[1]).integer;
-		return result;
+	case TOKEN_AND:
+	case TOKEN_OR:
 	case TOKEN_NOT:
+	case RUNTIME_LOCAL_OP_CONST:
+	case RUNTIME_LOCAL_OP_LOCAL:
+	case RUNTIME_GLOBAL_OP_CONST:
+		result.integer = evalInteger(node);
+		if (promoted) {
+			promoted = false;
+			return stack[--stackCount];
+		}
 		result.type = TYPE_INTEGER;
-		result.integer = !eval(&node->children[0]).integer;
 		return result;
 	default:
 		fprintf(stderr, "Error: Invalid syntax item for eval()\n");
@@ -0,0 +1,398 @@
+#define _POSIX_C_SOURCE 200809L
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+
+// NOTE:	Heap values are reclaimed by an incremental tri-color mark-sweep collector
+//			- The roots are the running value stack, the stacks of the coroutines waiting on it and the queued
+//			  tasks, see evalMarkRoots(), coroutineMarkRoots() and schedulerMarkRoots()
+//			- Work is only done inside gcAllocate() and gcAddRegion(), at most STEP_WORK units per call, so pauses
+//			  are bounded, except for the step that starts marking by shading the roots
+//			- Marking works on a snapshot of the heap as it was when it started: values that are overwritten in,
+//			  removed from or moved within heap objects go through gcBarrier() (Yuasa deletion barrier), so every
+//			  value that was reachable then is marked, and marking ends when no gray object is left
+//			- The value stacks need no barrier and are not scanned again, values they get later were reachable
+//			  at the start or were allocated since
+//			- A coroutine's stack becomes the value stack while it runs, so a coroutine that was not traced yet
+//			  is traced when it is resumed (gcBarrierResume())
+//			- Small objects are bump allocated from chunks and recycled through per-size free lists
+//			- gcPause() stops the collector while several threads run script code, allocation is then serialized
+//			- Strings that natives create live in regions (gcAddRegion()), a read_line() buffer or a mapped file,
+//			  shading a string marks the region that contains it, and regions left unmarked when marking ends
+//			  are released
+#define STEP_WORK			256
+#define MIN_THRESHOLD		(256 * 1024)
+#define CHUNK_SIZE			(64 * 1024)
+#define SIZE_CLASS_STEP		16
+#define SIZE_CLASS_COUNT	16	// Objects up to SIZE_CLASS_COUNT * SIZE_CLASS_STEP bytes use the pools
+
+enum {
+	COLOR_WHITE,
+	COLOR_GRAY,
+	COLOR_BLACK,
+};
+
+enum {
+	PHASE_IDLE,
+	PHASE_MARK,
+	PHASE_SWEEP,
+};
+
+typedef struct Gray	Gray;
+struct Gray {
+	Object*	object;
+	size_t	cursor;
+};
+
+typedef struct Region	Region;
+struct Region {
+	char*	memory;
+	size_t	size;
+	void	(*release)(void* memory, size_t size);
+	bool	marked;
+};
+
+typedef struct FreeSlot	FreeSlot;
+struct FreeSlot {
+	FreeSlot*	next;
+};
+
+static Object* objects = NULL;
+static Object* unswept = NULL;
+static uint8_t phase = PHASE_IDLE;
+static Gray* grays = NULL;
+static size_t grayCount = 0;
+static size_t grayCapacity = 0;
+static Region* regions = NULL;	// Sorted by address
+static size_t regionCount = 0;
+static size_t regionCapacity = 0;
+
+static FreeSlot* freeLists[SIZE_CLASS_COUNT];
+static uint8_t* chunk = NULL;
+static size_t chunkUsed = CHUNK_SIZE;
+
+static size_t bytesAllocated = 0;
+static size_t threshold = MIN_THRESHOLD;
+
+static GcStats stats;
+
+static bool paused = false;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t _now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void* poolAllocate(size_t size) {
+	if (size > SIZE_CLASS_COUNT * SIZE_CLASS_STEP) {
+		return memoryAllocate(size, MEMORY_HEAP);
+	}
+	const size_t class = (size - 1) / SIZE_CLASS_STEP;
+	if (freeLists[class] != NULL) {
+		FreeSlot* slot = freeLists[class];
+		freeLists[class] = slot->next;
+		return slot;
+	}
+	const size_t rounded = (class + 1) * SIZE_CLASS_STEP;
+	if (chunkUsed + rounded > CHUNK_SIZE) {
+		// Chunks are never returned, freed slots are reused through freeLists
+		chunk = memoryAllocate(CHUNK_SIZE, MEMORY_HEAP);
+		chunkUsed = 0;
+		stats.chunkBytes += CHUNK_SIZE;
+	}
+	void* memory = chunk + chunkUsed;
+	chunkUsed += rounded;
+	return memory;
+}
+
+static void poolFree(void* memory, size_t size) {
+	if (size > SIZE_CLASS_COUNT * SIZE_CLASS_STEP) {
+		memoryFree(memory);
+		return;
+	}
+	const size_t class = (size - 1) / SIZE_CLASS_STEP;
+	FreeSlot* slot = memory;
+	slot->next = freeLists[class];
+	freeLists[class] = slot;
+}
+
+static Object* _object(Data d) {
+	switch (d.type) {
+	case TYPE_MAP:
+		return (Object*)d.map;
+	case TYPE_COROUTINE:
+		return (Object*)d.coroutine;
+	case TYPE_BIGINT:
+		return (Object*)d.bigint;
+	default:
+		return NULL;
+	}
+}
+
+static void _pushGray(Object* object) {
+	if (grayCount == grayCapacity) {
+		grayCapacity = grayCapacity == 0 ? 64 : grayCapacity * 2;
+		grays = memoryReallocate(grays, grayCapacity * sizeof *grays, MEMORY_HEAP);
+	}
+	grays[grayCount].object = object;
+	grays[grayCount].cursor = 0;
+	++grayCount;
+}
+
+// Binary search for the region that contains 'chars', strings outside of regions belong to the tree
+static void _shadeString(const char* chars) {
+	size_t low = 0;
+	size_t high = regionCount;
+	while (low < high) {
+		const size_t middle = low + (high - low) / 2;
+		if ((uintptr_t)regions[middle].memory <= (uintptr_t)chars) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+	if (low != 0 && (uintptr_t)chars < (uintptr_t)regions[low - 1].memory + regions[low - 1].size) {
+		regions[low - 1].marked = true;
+	}
+}
+
+void gcShade(Data d) {
+	if (d.type == TYPE_STRING && regionCount != 0) {
+		_shadeString(d.string);
+		return;
+	}
+	Object* object = _object(d);
+	if (object != NULL && object->color == COLOR_WHITE) {
+		object->color = COLOR_GRAY;
+		_pushGray(object);
+	}
+}
+
+void gcBarrier(Data d) {
+	if (phase == PHASE_MARK) {
+		gcShade(d);
+	}
+}
+
+// An object whose entries moved so that a cursor into it is stale is traced again from the start, a black one
+// has shaded all of its entries already
+void gcRetrace(Object* object) {
+	if (phase == PHASE_MARK && object->color == COLOR_GRAY) {
+		_pushGray(object);
+	}
+}
+
+void gcBarrierResume(Coroutine* coroutine) {
+	Object* object = (Object*)coroutine;
+	if (phase == PHASE_MARK && object->color != COLOR_BLACK) {
+		size_t work = 0;
+		coroutineTrace(coroutine, &work);
+		// Tracing it again when it leaves the gray stack does no harm
+		object->color = COLOR_BLACK;
+	}
+}
+
+static void _track(ssize_t bytes) {
+	bytesAllocated += bytes;
+	if (bytesAllocated > stats.peakBytes) {
+		stats.peakBytes = bytesAllocated;
+	}
+}
+
+void gcTrack(ssize_t bytes) {
+	if (paused) {
+		pthread_mutex_lock(&lock);
+		_track(bytes);
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	_track(bytes);
+}
+
+static void _finalize(Object* object) {
+	switch (object->kind) {
+	case OBJECT_MAP:
+		mapFinalize((Map*)object);
+		break;
+	case OBJECT_COROUTINE:
+		coroutineFinalize((Coroutine*)object);
+		break;
+	}
+	bytesAllocated -= object->size;
+	poolFree(object, object->size);
+	++stats.freedObjects;
+}
+
+// Returns the amount of work done
+static size_t _markSome(size_t budget) {
+	size_t work = 0;
+	while (grayCount != 0 && work < budget) {
+		const Gray gray = grays[--grayCount];
+		size_t cursor = 0;
+		switch (gray.object->kind) {
+		case OBJECT_MAP:
+			cursor = mapTrace((Map*)gray.object, gray.cursor, budget - work, &work);
+			break;
+		case OBJECT_COROUTINE:
+			coroutineTrace((Coroutine*)gray.object, &work);
+			break;
+		default:
+			++work;
+			break;
+		}
+		if (cursor == 0) {
+			gray.object->color = COLOR_BLACK;
+		}
+		else {
+			// Still gray, continue from cursor in a later step
+			_pushGray(gray.object);
+			grays[grayCount - 1].cursor = cursor;
+		}
+	}
+	return work;
+}
+
+// Survivors are moved back onto 'objects', objects allocated meanwhile are never on 'unswept'
+static void _sweepSome(size_t budget) {
+	while (budget-- != 0 && unswept != NULL) {
+		Object* object = unswept;
+		unswept = object->next;
+		if (object->color == COLOR_WHITE) {
+			_finalize(object);
+		}
+		else {
+			object->color = COLOR_WHITE;
+			object->next = objects;
+			objects = object;
+		}
+	}
+	if (unswept == NULL) {
+		phase = PHASE_IDLE;
+		threshold = bytesAllocated * 2 > MIN_THRESHOLD ? bytesAllocated * 2 : MIN_THRESHOLD;
+		++stats.cycles;
+	}
+}
+
+static void _releaseRegions(void) {
+	size_t kept = 0;
+	for (size_t i = 0; i < regionCount; ++i) {
+		if (regions[i].marked) {
+			regions[i].marked = false;
+			regions[kept++] = regions[i];
+		}
+		else {
+			regions[i].release(regions[i].memory, regions[i].size);
+			bytesAllocated -= regions[i].size;
+			++stats.freedRegions;
+		}
+	}
+	regionCount = kept;
+}
+
+static void _markRoots(void) {
+	evalMarkRoots();
+	coroutineMarkRoots();
+	schedulerMarkRoots();
+}
+
+static void _step(void) {
+	const uint64_t start = _now();
+	switch (phase) {
+	case PHASE_IDLE:
+		phase = PHASE_MARK;
+		_markRoots();
+		break;
+	case PHASE_MARK:
+		_markSome(STEP_WORK);
+		if (grayCount == 0) {
+			_releaseRegions();
+			phase = PHASE_SWEEP;
+			unswept = objects;
+			objects = NULL;
+		}
+		break;
+	case PHASE_SWEEP:
+		_sweepSome(STEP_WORK);
+		break;
+	}
+	const uint64_t pause = _now() - start;
+	++stats.steps;
+	stats.totalPause += pause;
+	if (pause > stats.maxPause) {
+		stats.maxPause = pause;
+	}
+}
+
+void* gcAllocate(uint8_t kind, size_t size) {
+	if (paused) {
+		pthread_mutex_lock(&lock);
+	}
+	else if (phase != PHASE_IDLE || bytesAllocated >= threshold) {
+		_step();
+	}
+	Object* object = poolAllocate(size);
+	memset(object, 0, size);
+	object->kind = kind;
+	object->size = size;
+	// Objects allocated during marking must survive this cycle, the sweeper never sees later ones
+	object->color = phase == PHASE_MARK ? COLOR_BLACK : COLOR_WHITE;
+	object->next = objects;
+	objects = object;
+	_track(size);
+	if (paused) {
+		pthread_mutex_unlock(&lock);
+	}
+	return object;
+}
+
+// Hands 'memory' to the collector, which calls 'release' once no string points into it anymore
+// Adding a region does a step like gcAllocate(), so scripts that only create strings still reclaim them
+void gcAddRegion(void* memory, size_t size, void (*release)(void* memory, size_t size)) {
+	if (paused) {
+		pthread_mutex_lock(&lock);
+	}
+	else if (phase != PHASE_IDLE || bytesAllocated >= threshold) {
+		_step();
+	}
+	if (regionCount == regionCapacity) {
+		regionCapacity = regionCapacity == 0 ? 16 : regionCapacity * 2;
+		regions = memoryReallocate(regions, regionCapacity * sizeof *regions, MEMORY_HEAP);
+	}
+	size_t i = regionCount;
+	while (i != 0 && (uintptr_t)regions[i - 1].memory > (uintptr_t)memory) {
+		regions[i] = regions[i - 1];
+		--i;
+	}
+	regions[i].memory = memory;
+	regions[i].size = size;
+	regions[i].release = release;
+	// Like objects allocated during marking, strings that are created meanwhile survive the cycle
+	regions[i].marked = phase == PHASE_MARK;
+	++regionCount;
+	_track(size);
+	if (paused) {
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+// The cycle in progress is finished first, so that no barrier has work to do while paused
+void gcPause(bool pause) {
+	while (pause && phase != PHASE_IDLE) {
+		_step();
+	}
+	paused = pause;
+}
+
+GcStats gcStats(void) {
+	GcStats result = stats;
+	result.liveBytes = bytesAllocated;
+	return result;
+}
@@ -0,0 +1,234 @@
+#include "aardvark.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// NOTE:	Type inference runs after resolveProgram() and sets ParseNode::inferred on expressions
+//			- Every variable slot, parameter and function return gets the join of all values stored into it
+//			- Passes over the whole program repeat until nothing changes
+//			- Slots are tracked per function and index, so variables that share a slot share a type
+//			- INFERRED_NONE means no value was seen, which eval() treats like INFERRED_UNKNOWN
+//			- INFERRED_INTEGER includes Bigints, a proven integer may still have been promoted at runtime
+typedef struct Frame	Frame;
+struct Frame {
+	ParseNode*			function;	// NULL for top level code
+	uint8_t*			locals;
+	size_t				localCapacity;
+	uint8_t*			parameters;
+	uint8_t				returns;
+};
+
+static Frame* frames = NULL;
+static size_t frameCount = 0;
+static uint8_t* globals = NULL;
+static size_t globalCapacity = 0;
+static bool changed = false;
+
+static uint8_t infer(ParseNode* node, Frame* frame);
+
+static void _join(uint8_t* slot, uint8_t type) {
+	if (type == INFERRED_NONE || *slot == type || *slot == INFERRED_UNKNOWN) {
+		return;
+	}
+	*slot = *slot == INFERRED_NONE ? type : INFERRED_UNKNOWN;
+	changed = true;
+}
+
+static uint8_t* _grow(uint8_t** types, size_t* capacity, size_t index) {
+	if (index >= *capacity) {
+		const size_t newCapacity = index * 2 + 8;
+		*types = memoryReallocate(*types, newCapacity, MEMORY_ANALYSIS);
+		memset(*types + *capacity, INFERRED_NONE, newCapacity - *capacity);
+		*capacity = newCapacity;
+	}
+	return &(*types)[index];
+}
+
+static uint8_t* _slot(Frame* frame, const ParseNode* variable) {
+	if (variable->syntax == RUNTIME_KNOWN_GLOBAL_VARIABLE) {
+		return _grow(&globals, &globalCapacity, variable->stackIndex);
+	}
+	if (variable->stackIndex < 0) {
+		return &frame->parameters[-variable->stackIndex - 1];
+	}
+	return _grow(&frame->locals, &frame->localCapacity, variable->stackIndex);
+}
+
+// Functions are children of the root, so frames[1] onwards are sorted by address
+static Frame* _frame(const ParseNode* function) {
+	size_t low = 1;
+	size_t high = frameCount;
+	while (low < high) {
+		const size_t middle = low + (high - low) / 2;
+		if ((uintptr_t)frames[middle].function < (uintptr_t)function) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+	return low < frameCount && frames[low].function == function ? &frames[low] : NULL;
+}
+
+static uint8_t inferCall(ParseNode* node, Frame* frame) {
+	ParseNode* argList = &node->children[1];
+	if (node->syntax == RUNTIME_NATIVE_FUNCTION) {
+		infer(argList, frame);
+		return node->native->result;
+	}
+	Frame* callee = _frame(node->function);
+	if (callee == NULL) {
+		// Of a module, or defined by a previous line in the REPL, the types of its parameters are not tracked
+		infer(argList, frame);
+		return INFERRED_UNKNOWN;
+	}
+	const uint32_t parameterCount = node->function->children[1].childCount;
+	for (uint32_t i = 0; i < argList->childCount; ++i) {
+		const uint8_t type = infer(&argList->children[i], frame);
+		if (i < parameterCount) {
+			_join(&callee->parameters[i], type);
+		}
+	}
+	for (uint32_t i = argList->childCount; i < parameterCount; ++i) {
+		_join(&callee->parameters[i], INFERRED_UNKNOWN);
+	}
+	if (node->syntax == RUNTIME_GENERATOR_CALL) {
+		return INFERRED_UNKNOWN;
+	}
+	return callee->returns == INFERRED_NONE ? INFERRED_UNKNOWN : callee->returns;
+}
+
+static uint8_t infer(ParseNode* node, Frame* frame) {
+	uint8_t type = INFERRED_NONE;
+	switch (node->syntax) {
+	case TOKEN_INTEGER:
+		type = INFERRED_INTEGER;
+		break;
+	case TOKEN_STRING:
+		type = INFERRED_STRING;
+		break;
+	case RUNTIME_KNOWN_VARIABLE:
+	case RUNTIME_KNOWN_GLOBAL_VARIABLE:
+		type = *_slot(frame, node);
+		break;
+	case TOKEN_PLUS:
+	case TOKEN_MINUS:
+	case TOKEN_MULTIPLY:
+	case TOKEN_DIVIDE:
+	case TOKEN_EQUAL:
+	case TOKEN_NOT_EQUAL:
+	case TOKEN_GREATER:
+	case TOKEN_LESS:
+	case TOKEN_GREATER_EQUAL:
+	case TOKEN_LESS_EQUAL:
+	case TOKEN_AND:
+	case TOKEN_OR:
+	case TOKEN_NOT:
+		// Arithmetic on anything other than integers is a runtime error, so the result is always an integer
+		for (uint32_t i = 0; i < node->childCount; ++i) {
+			infer(&node->children[i], frame);
+		}
+		type = INFERRED_INTEGER;
+		break;
+	case RUNTIME_KNOWN_FUNCTION:
+	case RUNTIME_GENERATOR_CALL:
+	case RUNTIME_NATIVE_FUNCTION:
+		type = inferCall(node, frame);
+		break;
+	case SYNTAX_INDEX:
+		infer(&node->children[1], frame);
+		type = INFERRED_UNKNOWN;
+		break;
+	case SYNTAX_DECLARATION:
+		_join(_slot(frame, &node->children[0]),
+			node->childCount == 2 ? infer(&node->children[1], frame) : INFERRED_UNKNOWN);
+		node->children[0].inferred = *_slot(frame, &node->children[0]);
+		return INFERRED_NONE;
+	case SYNTAX_ASSIGNMENT:
+		_join(_slot(frame, &node->children[0]), infer(&node->children[1], frame));
+		node->children[0].inferred = *_slot(frame, &node->children[0]);
+		return INFERRED_NONE;
+	case SYNTAX_FOR:
+	case SYNTAX_PARALLEL_FOR:
+		_join(_slot(frame, &node->children[0]), INFERRED_INTEGER);
+		node->children[0].inferred = *_slot(frame, &node->children[0]);
+		for (uint32_t i = 1; i < node->childCount; ++i) {
+			infer(&node->children[i], frame);
+		}
+		return INFERRED_NONE;
+	case SYNTAX_RETURN:
+		_join(&frame->returns, node->childCount == 1 ? infer(&node->children[0], frame) : INFERRED_UNKNOWN);
+		return INFERRED_NONE;
+	case SYNTAX_FUNCTION:
+		return INFERRED_NONE;
+	default:
+		for (uint32_t i = 0; i < node->childCount; ++i) {
+			infer(&node->children[i], frame);
+		}
+		return INFERRED_NONE;
+	}
+	node->inferred = type;
+	return type;
+}
+
+static void _inferFunction(Frame* frame) {
+	ParseNode* body = &frame->function->children[2];
+	infer(body, frame);
+	// Falling off the end of a function returns nothing
+	if (body->childCount == 0 || body->children[body->childCount - 1].syntax != SYNTAX_RETURN) {
+		_join(&frame->returns, INFERRED_UNKNOWN);
+	}
+}
+
+static void _inferRoot(ParseNode* root, bool exported) {
+	frameCount = 1;
+	for (uint32_t i = 0; i < root->childCount; ++i) {
+		frameCount += root->children[i].syntax == SYNTAX_FUNCTION;
+	}
+	frames = memoryAllocateZeroed(frameCount * sizeof *frames, MEMORY_ANALYSIS);
+	size_t f = 1;
+	for (uint32_t i = 0; i < root->childCount; ++i) {
+		ParseNode* function = &root->children[i];
+		if (function->syntax == SYNTAX_FUNCTION) {
+			frames[f].function = function;
+			frames[f].parameters = memoryAllocateZeroed(function->children[1].childCount + 1, MEMORY_ANALYSIS);
+			if (exported) {
+				memset(frames[f].parameters, INFERRED_UNKNOWN, function->children[1].childCount);
+			}
+			++f;
+		}
+	}
+	do {
+		changed = false;
+		for (uint32_t i = 0; i < root->childCount; ++i) {
+			infer(&root->children[i], &frames[0]);
+		}
+		for (size_t i = 1; i < frameCount; ++i) {
+			_inferFunction(&frames[i]);
+		}
+	} while (changed);
+	for (size_t i = 0; i < frameCount; ++i) {
+		memoryFree(frames[i].locals);
+		memoryFree(frames[i].parameters);
+	}
+	memoryFree(frames);
+	frames = NULL;
+	frameCount = 0;
+}
+
+void inferProgram(ParseNode* root) {
+	_inferRoot(root, false);
+}
+
+// Functions of a module may be called with anything by the files that import it
+void inferModule(ParseNode* root) {
+	_inferRoot(root, true);
+}
+
+// Globals keep their types from one program to the next, like they keep their values in the REPL
+void inferReset(void) {
+	memoryFree(globals);
+	globals = NULL;
+	globalCapacity = 0;
+}
@@ -0,0 +1,145 @@
+#include "aardvark.h"
+
+#include <string.h>
+
+// NOTE:	Inlining replaces calls of small functions by a copy of the expression that they return
+//			- It runs after inferProgram(), the copies keep the types inferred for the function
+//			- A function qualifies when its body is a single 'return' of at most 'limit' nodes that does not
+//			  call the function itself
+//			- Arguments that are literals or variables of the caller are substituted for the parameters, the copy
+//			  then runs in the caller's frame and is quickened with it
+//			- Other arguments are evaluated into fresh slots above the caller's like the arguments of a call, and
+//			  the copy reads them as its parameters (RUNTIME_INLINED_CALL, see eval.c)
+//			- Globals are only substituted when the copy calls nothing, a call could assign them
+//			- Copies are inlined into again up to MAX_INLINE_DEPTH levels, which also ends mutual recursion
+//			- Calls used as statements are left alone, nothing uses their result
+//			- Inlined calls do not burn fuel, loops still do
+//			- Watch mode does not inline, replaced functions would not reach the copies
+#define MAX_INLINE_DEPTH	4
+
+static size_t _size(const ParseNode* node) {
+	size_t size = 1;
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		size += _size(&node->children[i]);
+	}
+	return size;
+}
+
+// Whether 'node' calls 'function', or calls anything if 'function' is NULL
+static bool _calls(const ParseNode* node, const ParseNode* function) {
+	switch (node->syntax) {
+	case RUNTIME_KNOWN_FUNCTION:
+	case RUNTIME_GENERATOR_CALL:
+	case RUNTIME_INLINED_CALL:
+		if (function == NULL || node->function == function) {
+			return true;
+		}
+		break;
+	case RUNTIME_NATIVE_FUNCTION:
+		if (function == NULL) {
+			return true;
+		}
+		break;
+	}
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		if (_calls(&node->children[i], function)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// The expression to copy in place of 'call', or NULL
+static const ParseNode* _inlinable(const ParseNode* call, size_t limit) {
+	if (call->syntax != RUNTIME_KNOWN_FUNCTION) {
+		return NULL;
+	}
+	const ParseNode* function = call->function;
+	const ParseNode* body = &function->children[2];
+	if (body->syntax != SYNTAX_BLOCK || body->childCount != 1 || body->children[0].syntax != SYNTAX_RETURN
+		|| body->children[0].childCount != 1 || call->children[1].childCount != function->children[1].childCount) {
+		return NULL;
+	}
+	const ParseNode* expression = &body->children[0].children[0];
+	if (_size(expression) > limit || _calls(expression, function)) {
+		return NULL;
+	}
+	return expression;
+}
+
+// Parameters are replaced by copies of 'args' unless it is NULL
+static void _copy(ParseNode* to, const ParseNode* from, const ParseNode* args) {
+	if (args != NULL && from->syntax == RUNTIME_KNOWN_VARIABLE && from->stackIndex < 0) {
+		_copy(to, &args->children[-from->stackIndex - 1], NULL);
+		return;
+	}
+	*to = *from;
+	to->childCapacity = from->childCount;
+	to->children = from->childCount == 0 ? NULL
+		: memoryAllocate(from->childCount * sizeof *to->children, MEMORY_SYNTAX_TREE);
+	if (from->syntax == TOKEN_STRING) {
+		const size_t length = strlen(from->data.stringLiteral);
+		char* string = memoryAllocate(length + 1, MEMORY_SYNTAX_TREE);
+		memcpy(string, from->data.stringLiteral, length + 1);
+		to->data.stringLiteral = string;
+	}
+	for (uint32_t i = 0; i < from->childCount; ++i) {
+		// The expression of an inlined call reads the parameters of its own frame
+		_copy(&to->children[i], &from->children[i], from->syntax == RUNTIME_INLINED_CALL && i == 1 ? NULL : args);
+	}
+}
+
+static bool _substitutable(const ParseNode* args, bool calls) {
+	for (uint32_t i = 0; i < args->childCount; ++i) {
+		switch (args->children[i].syntax) {
+		case TOKEN_INTEGER:
+		case TOKEN_STRING:
+		case RUNTIME_KNOWN_VARIABLE:
+			break;
+		case RUNTIME_KNOWN_GLOBAL_VARIABLE:
+			if (calls) {
+				return false;
+			}
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+static void _inline(ParseNode* node, size_t limit, unsigned depth, bool statement) {
+	const bool block = node->syntax == SYNTAX_BLOCK || node->syntax == SYNTAX_PROGRAM;
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		_inline(&node->children[i], limit, depth, block);
+	}
+	if (statement || depth == MAX_INLINE_DEPTH) {
+		return;
+	}
+	const ParseNode* expression = _inlinable(node, limit);
+	if (expression == NULL) {
+		return;
+	}
+	ParseNode copy;
+	if (_substitutable(&node->children[1], _calls(expression, NULL))) {
+		_copy(&copy, expression, &node->children[1]);
+		parseTreeFree(node);
+		*node = copy;
+	}
+	else {
+		_copy(&copy, expression, NULL);
+		const ParseNode args = node->children[1];
+		memoryFree(node->children);
+		node->children = memoryAllocate(2 * sizeof *node->children, MEMORY_SYNTAX_TREE);
+		node->children[0] = args;
+		node->children[1] = copy;
+		node->childCount = node->childCapacity = 2;
+		node->syntax = RUNTIME_INLINED_CALL;
+	}
+	_inline(node, limit, depth + 1, false);
+}
+
+// Inlines the calls of functions whose returned expression has at most 'limit' nodes
+void inlineProgram(ParseNode* root, size_t limit) {
+	_inline(root, limit, 0, false);
+}
@@ -0,0 +1,65 @@
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// NOTE:	Line mode (-n, or -p to also print every line) runs the statements of a script once per line of stdin
+//			- The program is rewritten before it is resolved, as if the script had been
+//			  'var line  BEGIN()  line = read_line()  while line do <statements> print(line) line = read_line() end  END()'
+//			  so it is compiled once and the loop is quickened like any other
+//			- 'line' is a global that points into the buffer of read_line(), reading a line allocates nothing, and
+//			  it stays valid when it is kept in another variable or a map (see the notes of native.c)
+//			- Globals, functions and imports stay where they are, globals are initialized once before BEGIN()
+//			- BEGIN() and END() are only called when the script defines them
+static bool _defines(const ParseNode* root, const char* name) {
+	const uint64_t identifier = hash((const uint8_t*)name, strlen(name));
+	for (uint32_t i = 0; i < root->childCount; ++i) {
+		if (root->children[i].syntax == SYNTAX_FUNCTION && root->children[i].children[0].data.identifier == identifier) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void linesWrap(ParseNode* root, bool print) {
+	char source[128];
+	const int size = snprintf(source, sizeof source, "var line\n%sline = read_line()\nwhile line do\n%s"
+		"line = read_line()\nend\n%s", _defines(root, "BEGIN") ? "BEGIN()\n" : "", print ? "print(line)\n" : "",
+		_defines(root, "END") ? "END()\n" : "");
+	TokenList list = tokenize(source, size);
+	ParseNode* loop = parseProgram(&list, false);
+	ParseNode* children = memoryAllocate((root->childCount + loop->childCount) * sizeof *children, MEMORY_SYNTAX_TREE);
+	uint32_t childCount = 0;
+	children[childCount++] = loop->children[0];
+	uint32_t statementCount = 0;
+	for (uint32_t i = 0; i < root->childCount; ++i) {
+		const Syntax syntax = root->children[i].syntax;
+		if (syntax == SYNTAX_DECLARATION || syntax == SYNTAX_FUNCTION || syntax == SYNTAX_IMPORT) {
+			children[childCount++] = root->children[i];
+		}
+		else {
+			// Statements are moved to the front of the array, ahead of the kept components
+			root->children[statementCount++] = root->children[i];
+		}
+	}
+	for (uint32_t i = 1; i < loop->childCount; ++i) {
+		ParseNode* node = &children[childCount++];
+		*node = loop->children[i];
+		if (node->syntax != SYNTAX_WHILE) {
+			continue;
+		}
+		ParseNode* body = &node->children[1];
+		ParseNode* statements = memoryAllocate((statementCount + body->childCount) * sizeof *statements,
+			MEMORY_SYNTAX_TREE);
+		memcpy(statements, root->children, statementCount * sizeof *statements);
+		memcpy(statements + statementCount, body->children, body->childCount * sizeof *statements);
+		memoryFree(body->children);
+		body->children = statements;
+		body->childCount = body->childCapacity = statementCount + body->childCount;
+	}
+	memoryFree(root->children);
+	root->children = children;
+	root->childCount = root->childCapacity = childCount;
+	memoryFree(loop->children);
+	memoryFree(loop);
+}
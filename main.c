@@ -8,18 +8,77 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 
-#define BUFFER_SIZE	128
+#define BUFFER_SIZE			128
+#define DEFAULT_CACHE_LIMIT	(64 * 1024 * 1024)
+#define DEFAULT_INLINE_LIMIT	16
 
 enum {
 	FLAGS_INTERPRET_FILE	= 0x1,
 	FLAGS_SHOW_TOKEN_LIST	= 0x2,
 	FLAGS_SHOW_SYNTAX_TREE	= 0x4,
+	FLAGS_SHOW_GC_STATS		= 0x8,
+	FLAGS_LAZY_PARSE		= 0x10,
+	FLAGS_SHOW_MEMORY_STATS	= 0x20,
+	FLAGS_EACH_LINE			= 0x40,
+	FLAGS_PRINT_LINES		= 0x80,
 };
 
-static void interpret(char* chars, size_t size, uint32_t flags) {
+static const char* subsystems[MEMORY_SUBSYSTEM_COUNT] = {
+	"source",
+	"tokens",
+	"syntax tree",
+	"analysis",
+	"stacks",
+	"heap",
+	"trace",
+};
+
+static size_t inlineLimit = DEFAULT_INLINE_LIMIT;	// 0 for no inlining
+
+static void printGcStats(void) {
+	const GcStats s = gcStats();
+	fflush(stdout);
+	fprintf(stderr, "GC: %zu cycles, %zu steps, max pause %.1fus, mean pause %.1fus, %zu objects freed, "
+		"%zu regions freed, %zu live bytes, %zu peak bytes, %zu pool bytes\n",
+		s.cycles, s.steps, s.maxPause / 1000.0, s.steps == 0 ? 0.0 : s.totalPause / 1000.0 / s.steps,
+		s.freedObjects, s.freedRegions, s.liveBytes, s.peakBytes, s.chunkBytes);
+}
+
+static void printMemoryStats(void) {
+	const MemoryStats s = memoryStats();
+	fflush(stdout);
+	fprintf(stderr, "Memory: %zu live bytes, %zu peak bytes\n", s.totalLive, s.totalPeak);
+	for (size_t i = 0; i < MEMORY_SUBSYSTEM_COUNT; ++i) {
+		fprintf(stderr, "    %s: %zu live bytes, %zu peak bytes\n", subsystems[i], s.live[i], s.peak[i]);
+	}
+}
+
+static void printResult(Data result) {
+	switch (result.type) {
+	case TYPE_INTEGER:
+		printf("%li\n", result.integer);
+		break;
+	case TYPE_BIGINT:
+		bigintPrint(result.bigint);
+		putchar('\n');
+		break;
+	case TYPE_STRING:
+		printf("\"%s\"\n", result.string);
+		break;
+	case TYPE_NONE:
+	case TYPE_VOID:
+	default:
+		break;
+	}
+}
+
+// Returns NULL if the source does not parse
+static ParseNode* load(char* chars, size_t size, uint32_t flags) {
+	tracePhase("tokenize");
 	TokenList list = tokenize(chars, size);
+	tracePhase(NULL);
 	if (flags & FLAGS_INTERPRET_FILE) {
-		free(chars);
+		memoryFree(chars);
 	}
 	if (flags & FLAGS_SHOW_TOKEN_LIST) {
 		printf("Token list:\n");
@@ -27,40 +86,63 @@ static void interpret(char* chars, size_t size, uint32_t flags) {
 			printf("(No tokens)\n");
 		}
 		else {
-			printSyntax(list.tokens[0].syntax);
+			printSyntax(list.syntax[0]);
 			for (size_t i = 1; i < list.tokenCount; ++i) {
 				putchar(',');
 				putchar(' ');
-				printSyntax(list.tokens[i].syntax);
+				printSyntax(list.syntax[i]);
 			}
 			putchar('\n');
 		}
 		putchar('\n');
 	}
-	ParseNode* parseTree = parseProgram(&list);
+	tracePhase("parse");
+	ParseNode* parseTree = parseProgram(&list, flags & FLAGS_LAZY_PARSE);
+	tracePhase(NULL);
 	if (parseTree == NULL) {
-		return;
+		return NULL;
+	}
+	if (flags & (FLAGS_EACH_LINE | FLAGS_PRINT_LINES)) {
+		linesWrap(parseTree, flags & FLAGS_PRINT_LINES);
+	}
+	tracePhase("resolve");
+	resolveProgram(parseTree);
+	tracePhase(NULL);
+	tracePhase("infer");
+	inferProgram(parseTree);
+	tracePhase(NULL);
+	if (inlineLimit != 0) {
+		tracePhase("inline");
+		inlineProgram(parseTree, inlineLimit);
+		tracePhase(NULL);
 	}
 	if (flags & FLAGS_SHOW_SYNTAX_TREE) {
 		printf("Parse tree:\n");
 		parseTreePrint(parseTree);
 		putchar('\n');
 	}
-	Data result = eval(parseTree);
-	switch (result.type) {
-	case TYPE_INTEGER:
-		printf("%li\n", result.integer);
-		break;
-	case TYPE_STRING:
-		printf("\"%s\"\n", result.string);
-		break;
-	case TYPE_NONE:
-	case TYPE_VOID:
-	default:
-		break;
+	return parseTree;
+}
+
+static void interpret(char* chars, size_t size, uint32_t flags) {
+	ParseNode* parseTree = load(chars, size, flags);
+	if (parseTree == NULL) {
+		return;
+	}
+	tracePhase("run");
+	printResult(eval(parseTree));
+	tracePhase(NULL);
+	if (flags & FLAGS_SHOW_GC_STATS) {
+		printGcStats();
+	}
+	// Later lines of the REPL use the functions and string literals of earlier ones
+	if (flags & FLAGS_INTERPRET_FILE) {
+		parseTreeFree(parseTree);
+		memoryFree(parseTree);
+	}
+	if (flags & FLAGS_SHOW_MEMORY_STATS) {
+		printMemoryStats();
 	}
-	parseTreeFree(parseTree);
-	free(parseTree);
 }
 
 static uint32_t flag(char c) {
@@ -69,6 +151,16 @@ static uint32_t flag(char c) {
 		return FLAGS_SHOW_TOKEN_LIST;
 	case 's':
 		return FLAGS_SHOW_SYNTAX_TREE;
+	case 'g':
+		return FLAGS_SHOW_GC_STATS;
+	case 'l':
+		return FLAGS_LAZY_PARSE;
+	case 'm':
+		return FLAGS_SHOW_MEMORY_STATS;
+	case 'n':
+		return FLAGS_EACH_LINE;
+	case 'p':
+		return FLAGS_PRINT_LINES;
 	default:
 		fprintf(stderr, "Error: Unknown flag '%c'\n", c);
 		exit(EXIT_FAILURE);
@@ -100,19 +192,127 @@ static int repl(uint32_t flags) {
 int main(int argc, const char* argv[]) {
 	const char* filepath = NULL;
 	uint32_t flags = 0;
+	size_t memoryLimit = 0;
+	bool watch = false;
+	const char* server = NULL;
+	const char* daemon = NULL;
+	const char* submit = NULL;
+	size_t cacheLimit = DEFAULT_CACHE_LIMIT;
+	long fuel = 0;
+	const char* trace = NULL;
 	for (int i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "--help") == 0) {
 			printf("Usage: %s [options] [file]\n", argv[0]);
-			printf("Options:\n    -t: Show token list\n    -s: Show syntax tree\n");
+			printf("Options:\n    -t: Show token list\n    -s: Show syntax tree\n    -g: Show garbage collector statistics\n"
+				"    -l: Only parse the functions that are called\n"
+				"    -m: Show memory statistics\n"
+				"    -n: Run the statements for every line of stdin, which is in the global 'line'\n"
+				"    -p: Like -n, and print 'line' after the statements\n"
+				"    --memory-limit <megabytes>: Stop scripts that allocate more\n"
+				"    --inline-limit <nodes>: Inline functions that return an expression of up to this size (default 16)\n"
+				"    --no-inline: Do not inline functions\n"
+				"    --watch: Reload the functions of the file whenever it is saved, implies --no-inline\n"
+				"    --fuel <units>: Stop scripts that run more loop iterations and calls\n"
+				"    --trace <file>: Write the calls, long loops and phases of the run to a Chrome trace file\n"
+				"    --fork-server <socket>: Run the global initializers once and fork for every request\n"
+				"    --connect <socket>: Send a request to a fork server\n"
+				"    --daemon <socket>: Run the scripts submitted to the socket, and cache them\n"
+				"    --cache-limit <megabytes>: Bytes of compiled programs that a daemon keeps (default 64)\n"
+				"    --submit <socket>: Send the file to a daemon to run\n"
+				"    --daemon-stats <socket>: Show the cache statistics of a daemon\n");
 			return EXIT_SUCCESS;
 		}
-		if (argv[i][0] == '-') {
+		if (strcmp(argv[i], "--memory-limit") == 0) {
+			const long megabytes = i + 1 < argc ? strtol(argv[++i], NULL, 10) : 0;
+			if (megabytes <= 0) {
+				fprintf(stderr, "Error: Expected a number of megabytes after '--memory-limit'\n");
+				return EXIT_FAILURE;
+			}
+			memoryLimit = (size_t)megabytes * 1024 * 1024;
+		}
+		else if (strcmp(argv[i], "--fuel") == 0) {
+			fuel = i + 1 < argc ? strtol(argv[++i], NULL, 10) : 0;
+			if (fuel <= 0) {
+				fprintf(stderr, "Error: Expected a number of units after '--fuel'\n");
+				return EXIT_FAILURE;
+			}
+		}
+		else if (strcmp(argv[i], "--inline-limit") == 0) {
+			const long nodes = i + 1 < argc ? strtol(argv[++i], NULL, 10) : 0;
+			if (nodes <= 0) {
+				fprintf(stderr, "Error: Expected a number of nodes after '--inline-limit'\n");
+				return EXIT_FAILURE;
+			}
+			inlineLimit = nodes;
+		}
+		else if (strcmp(argv[i], "--no-inline") == 0) {
+			inlineLimit = 0;
+		}
+		else if (strcmp(argv[i], "--cache-limit") == 0) {
+			const long megabytes = i + 1 < argc ? strtol(argv[++i], NULL, 10) : 0;
+			if (megabytes <= 0) {
+				fprintf(stderr, "Error: Expected a number of megabytes after '--cache-limit'\n");
+				return EXIT_FAILURE;
+			}
+			cacheLimit = (size_t)megabytes * 1024 * 1024;
+		}
+		else if (strcmp(argv[i], "--fork-server") == 0 || strcmp(argv[i], "--connect") == 0
+			|| strcmp(argv[i], "--daemon") == 0 || strcmp(argv[i], "--submit") == 0
+			|| strcmp(argv[i], "--daemon-stats") == 0) {
+			if (i + 1 == argc) {
+				fprintf(stderr, "Error: Expected a socket path after '%s'\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+			if (strcmp(argv[i], "--connect") == 0) {
+				return serverConnect(argv[i + 1]);
+			}
+			if (strcmp(argv[i], "--daemon-stats") == 0) {
+				return serverStats(argv[i + 1]);
+			}
+			if (strcmp(argv[i], "--daemon") == 0) {
+				daemon = argv[++i];
+			}
+			else if (strcmp(argv[i], "--submit") == 0) {
+				submit = argv[++i];
+			}
+			else {
+				server = argv[++i];
+			}
+		}
+		else if (strcmp(argv[i], "--trace") == 0) {
+			if (i + 1 == argc) {
+				fprintf(stderr, "Error: Expected a file path after '--trace'\n");
+				return EXIT_FAILURE;
+			}
+			trace = argv[++i];
+		}
+		else if (strcmp(argv[i], "--watch") == 0) {
+			watch = true;
+		}
+		else if (argv[i][0] == '-') {
 			flags |= parseFlags(argv[i]);
 		}
 		else {
 			filepath = argv[i];
 		}
 	}
+	// Before anything is allocated
+	if (memoryLimit != 0) {
+		memoryUse(memoryBudgetedAllocator(memoryLimit));
+	}
+	else if (flags & FLAGS_SHOW_MEMORY_STATS) {
+		memoryUse(memoryTrackingAllocator());
+	}
+	if (fuel != 0) {
+		schedulerSetFuelLimit(fuel);
+	}
+	if (trace != NULL) {
+		traceStart(trace);
+	}
+	if (daemon != NULL) {
+		printResult(eval(serverDaemon(daemon, cacheLimit, inlineLimit)));
+		return EXIT_SUCCESS;
+	}
 	if (filepath != NULL) {
 		int file = open(filepath, O_RDONLY);
 		if (file == -1) {
@@ -126,9 +326,28 @@ int main(int argc, const char* argv[]) {
 			return EXIT_FAILURE;
 		}
 		const size_t size = s.st_size;
-		char* chars = malloc(size);
+		moduleSetMainPath(filepath);
+		char* chars = memoryAllocate(size, MEMORY_SOURCE);
 		read(file, chars, size);
 		close(file);
+		if (submit != NULL) {
+			const int status = serverSubmit(submit, chars, size);
+			memoryFree(chars);
+			return status;
+		}
+		if (watch) {
+			printResult(watchRun(filepath, chars, size));
+			return EXIT_SUCCESS;
+		}
+		if (server != NULL) {
+			ParseNode* parseTree = load(chars, size, flags | FLAGS_INTERPRET_FILE);
+			if (parseTree == NULL) {
+				return EXIT_FAILURE;
+			}
+			serverRun(server, parseTree);
+			printResult(evalStatements(parseTree));
+			return EXIT_SUCCESS;
+		}
 		interpret(chars, size, flags | FLAGS_INTERPRET_FILE);
 		return EXIT_SUCCESS;
 	}
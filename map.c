@@ -0,0 +1,355 @@
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// NOTE:	Maps are Robin Hood hash tables with a separate array of control bytes
+//			- A control byte is 0 for an empty slot, otherwise it is the probe distance + 1
+//			- Probing only touches the entry array when the control byte could match
+//			- Growing does not rehash everything at once: the previous table is kept as 'old'
+//			  and drained a few slots at a time by every insertion or deletion
+//			- Inserting a new key or deleting one may move entries between slots, so it changes the version of the
+//			  map, which invalidates the cursors of scripts (see map_next())
+#define INITIAL_CAPACITY	8
+#define MIGRATE_STEP		16
+#define CONTROL_EMPTY		0
+#define CONTROL_MOVED		0x80	// Slot of 'old' that has been migrated or deleted
+#define MAX_DISTANCE		0x7f
+
+typedef struct Entry	Entry;
+struct Entry {
+	Data		key;
+	Data		value;
+	uint64_t	hash;
+};
+
+typedef struct Table	Table;
+struct Table {
+	uint8_t*	control;
+	Entry*		entries;
+	size_t		capacity;
+	size_t		count;
+};
+
+struct Map {
+	Object	object;
+	Table	current;
+	Table	old;
+	size_t	migrated;
+	uint32_t	version;
+};
+
+static uint64_t _hashKey(Data key) {
+	switch (key.type) {
+	case TYPE_INTEGER:
+		return hashMix((uint64_t)key.integer);
+	case TYPE_BIGINT:
+		return hashMix(bigintHash(key.bigint) ^ TYPE_BIGINT);
+	case TYPE_STRING: {
+		uint64_t result = 0xcbf29ce484222325;
+		for (const char* c = key.string; *c != '\0'; ++c) {
+			result ^= (uint8_t)*c;
+			result *= 0x100000001b3;
+		}
+		return hashMix(result ^ TYPE_STRING);
+	}
+	default:
+		fprintf(stderr, "Error: Map keys must be integers or strings\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static bool _keyEqual(Data a, Data b) {
+	if (a.type != b.type) {
+		return false;
+	}
+	if (a.type == TYPE_INTEGER) {
+		return a.integer == b.integer;
+	}
+	if (a.type == TYPE_BIGINT) {
+		return bigintCompare(a, b) == 0;
+	}
+	return strcmp(a.string, b.string) == 0;
+}
+
+static void tableCreate(Table* table, size_t capacity) {
+	table->capacity = capacity;
+	table->count = 0;
+	table->control = memoryAllocateZeroed(capacity * sizeof *table->control, MEMORY_HEAP);
+	table->entries = memoryAllocate(capacity * sizeof *table->entries, MEMORY_HEAP);
+	gcTrack(capacity * (sizeof *table->control + sizeof *table->entries));
+}
+
+static void tableFree(Table* table) {
+	gcTrack(-(ssize_t)(table->capacity * (sizeof *table->control + sizeof *table->entries)));
+	memoryFree(table->control);
+	memoryFree(table->entries);
+	memset(table, 0, sizeof *table);
+}
+
+// Returns the slot index, or -1 if the key is not in the table
+static ssize_t tableFind(const Table* table, Data key, uint64_t hash) {
+	if (table->capacity == 0) {
+		return -1;
+	}
+	const size_t mask = table->capacity - 1;
+	size_t i = hash & mask;
+	for (uint8_t distance = 1; distance <= MAX_DISTANCE; ++distance) {
+		const uint8_t control = table->control[i];
+		if (control == CONTROL_EMPTY || (control & MAX_DISTANCE) < distance) {
+			return -1;
+		}
+		if (control == distance && table->entries[i].hash == hash && _keyEqual(table->entries[i].key, key)) {
+			return i;
+		}
+		i = (i + 1) & mask;
+	}
+	return -1;
+}
+
+// Returns false if the probe distance limit was reached, the entry is then left in *entry
+static bool tableInsert(Table* table, Entry* entry) {
+	const size_t mask = table->capacity - 1;
+	size_t i = entry->hash & mask;
+	uint8_t distance = 1;
+	while (true) {
+		const uint8_t control = table->control[i];
+		if (control == CONTROL_EMPTY) {
+			table->control[i] = distance;
+			table->entries[i] = *entry;
+			gcBarrier(entry->key);
+			gcBarrier(entry->value);
+			++table->count;
+			return true;
+		}
+		if (control < distance) {
+			// Robin Hood: take the slot from the entry that is closer to its home
+			Entry displaced = table->entries[i];
+			table->entries[i] = *entry;
+			table->control[i] = distance;
+			gcBarrier(entry->key);
+			gcBarrier(entry->value);
+			*entry = displaced;
+			distance = control;
+		}
+		if (distance == MAX_DISTANCE) {
+			return false;
+		}
+		++distance;
+		i = (i + 1) & mask;
+	}
+}
+
+// Backward shift deletion, no tombstones are left in the current table
+static void tableErase(Table* table, size_t i) {
+	const size_t mask = table->capacity - 1;
+	size_t next = (i + 1) & mask;
+	gcBarrier(table->entries[i].key);
+	gcBarrier(table->entries[i].value);
+	while (table->control[next] > 1) {
+		table->control[i] = table->control[next] - 1;
+		table->entries[i] = table->entries[next];
+		// A trace that is past 'i' but not yet at 'next' would miss it
+		gcBarrier(table->entries[i].key);
+		gcBarrier(table->entries[i].value);
+		i = next;
+		next = (next + 1) & mask;
+	}
+	table->control[i] = CONTROL_EMPTY;
+	--table->count;
+}
+
+static void _migrate(Map* map, size_t steps) {
+	if (map->old.capacity == 0) {
+		return;
+	}
+	while (steps-- != 0 && map->migrated < map->old.capacity) {
+		const size_t i = map->migrated++;
+		const uint8_t control = map->old.control[i];
+		if (control == CONTROL_EMPTY || (control & CONTROL_MOVED)) {
+			continue;
+		}
+		map->old.control[i] |= CONTROL_MOVED;
+		--map->old.count;
+		Entry entry = map->old.entries[i];
+		const bool inserted = tableInsert(&map->current, &entry);
+		assert(inserted);
+		(void)inserted;
+	}
+	if (map->migrated == map->old.capacity) {
+		tableFree(&map->old);
+		map->migrated = 0;
+		// Cursors into 'current' are offset by the capacity of 'old'
+		gcRetrace(&map->object);
+	}
+}
+
+// Only used when the probe distance limit is hit, which a reasonable hash should never do
+static void _rehashNow(Map* map, Entry* pending) {
+	_migrate(map, SIZE_MAX);
+	Table previous = map->current;
+	tableCreate(&map->current, previous.capacity * 2);
+	for (size_t i = 0; i < previous.capacity; ++i) {
+		if (previous.control[i] != CONTROL_EMPTY) {
+			Entry entry = previous.entries[i];
+			if (!tableInsert(&map->current, &entry)) {
+				fprintf(stderr, "Error: Map probe distance limit exceeded\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	tableFree(&previous);
+	if (!tableInsert(&map->current, pending)) {
+		fprintf(stderr, "Error: Map probe distance limit exceeded\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+Map* mapCreate(void) {
+	Map* map = gcAllocate(OBJECT_MAP, sizeof *map);
+	tableCreate(&map->current, INITIAL_CAPACITY);
+	return map;
+}
+
+// Called by the collector, which owns the memory of the Map itself
+void mapFinalize(Map* map) {
+	tableFree(&map->current);
+	tableFree(&map->old);
+}
+
+size_t mapSize(const Map* map) {
+	return map->current.count + map->old.count;
+}
+
+Data mapGet(const Map* map, Data key) {
+	const uint64_t hash = _hashKey(key);
+	ssize_t i = tableFind(&map->current, key, hash);
+	if (i != -1) {
+		return map->current.entries[i].value;
+	}
+	i = tableFind(&map->old, key, hash);
+	if (i != -1) {
+		return map->old.entries[i].value;
+	}
+	Data result = { .type = TYPE_VOID };
+	return result;
+}
+
+bool mapContains(const Map* map, Data key) {
+	const uint64_t hash = _hashKey(key);
+	return tableFind(&map->current, key, hash) != -1 || tableFind(&map->old, key, hash) != -1;
+}
+
+void mapSet(Map* map, Data key, Data value) {
+	const uint64_t hash = _hashKey(key);
+	// Updating an existing key never moves entries, so it is safe while iterating and keeps the version
+	ssize_t i = tableFind(&map->current, key, hash);
+	if (i != -1) {
+		gcBarrier(map->current.entries[i].value);
+		map->current.entries[i].value = value;
+		return;
+	}
+	i = tableFind(&map->old, key, hash);
+	if (i != -1) {
+		gcBarrier(map->old.entries[i].value);
+		map->old.entries[i].value = value;
+		return;
+	}
+	++map->version;
+	_migrate(map, MIGRATE_STEP);
+	if (map->old.capacity == 0 && (map->current.count + 1) * 5 > map->current.capacity * 4) {
+		map->old = map->current;
+		map->migrated = 0;
+		tableCreate(&map->current, map->old.capacity * 2);
+		_migrate(map, MIGRATE_STEP);
+	}
+	Entry entry = { .key = key, .value = value, .hash = hash };
+	if (!tableInsert(&map->current, &entry)) {
+		_rehashNow(map, &entry);
+	}
+}
+
+bool mapDelete(Map* map, Data key) {
+	const uint64_t hash = _hashKey(key);
+	bool found = false;
+	ssize_t i = tableFind(&map->current, key, hash);
+	if (i != -1) {
+		tableErase(&map->current, i);
+		found = true;
+	}
+	else if ((i = tableFind(&map->old, key, hash)) != -1) {
+		gcBarrier(map->old.entries[i].key);
+		gcBarrier(map->old.entries[i].value);
+		map->old.control[i] |= CONTROL_MOVED;
+		--map->old.count;
+		found = true;
+	}
+	if (found) {
+		++map->version;
+	}
+	_migrate(map, MIGRATE_STEP);
+	return found;
+}
+
+// NOTE:	Cursors index the slots of 'old' followed by the slots of 'current', offset by 1 so that 0 means
+//			'before the first entry' as well as 'no more entries'
+static const Entry* _entryAt(const Map* map, size_t cursor) {
+	assert(cursor != 0);
+	const size_t i = cursor - 1;
+	if (i < map->old.capacity) {
+		const uint8_t control = map->old.control[i];
+		return control == CONTROL_EMPTY || (control & CONTROL_MOVED) ? NULL : &map->old.entries[i];
+	}
+	if (i - map->old.capacity < map->current.capacity) {
+		const size_t j = i - map->old.capacity;
+		return map->current.control[j] == CONTROL_EMPTY ? NULL : &map->current.entries[j];
+	}
+	return NULL;
+}
+
+uint32_t mapVersion(const Map* map) {
+	return map->version;
+}
+
+size_t mapNext(const Map* map, size_t cursor) {
+	const size_t end = map->old.capacity + map->current.capacity;
+	while (cursor++ < end) {
+		if (_entryAt(map, cursor) != NULL) {
+			return cursor;
+		}
+	}
+	return 0;
+}
+
+static const Entry* _checkedEntryAt(const Map* map, size_t cursor) {
+	const Entry* entry = cursor == 0 ? NULL : _entryAt(map, cursor);
+	if (entry == NULL) {
+		fprintf(stderr, "Error: Invalid map cursor\n");
+		exit(EXIT_FAILURE);
+	}
+	return entry;
+}
+
+Data mapKeyAt(const Map* map, size_t cursor) {
+	return _checkedEntryAt(map, cursor)->key;
+}
+
+Data mapValueAt(const Map* map, size_t cursor) {
+	return _checkedEntryAt(map, cursor)->value;
+}
+
+// Shades the keys and values of up to 'budget' entries starting after 'cursor', returns the cursor to continue from or 0
+size_t mapTrace(const Map* map, size_t cursor, size_t budget, size_t* work) {
+	++*work;
+	for (size_t it = mapNext(map, cursor); it != 0; it = mapNext(map, it)) {
+		gcShade(mapKeyAt(map, it));
+		gcShade(mapValueAt(map, it));
+		++*work;
+		if (--budget == 0) {
+			return mapNext(map, it) == 0 ? 0 : it;
+		}
+	}
+	return 0;
+}
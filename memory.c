@@ -0,0 +1,139 @@
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// NOTE:	Every allocation of the interpreter goes through the current Allocator, see memoryUse()
+//			- memoryAllocate() and friends never return NULL, a failed allocation ends the script with an error
+//			- The tracking allocators put a header in front of every block, so that memoryFree() knows the size
+//			  and subsystem, and an allocator cannot be replaced once memory has been allocated with it
+//			- Counters are updated atomically, the pool threads allocate too
+typedef struct Header	Header;
+struct Header {
+	size_t	size;
+	uint8_t	subsystem;
+} __attribute__((aligned(16)));	// Keeps the alignment of malloc()
+
+typedef struct Tracking	Tracking;
+struct Tracking {
+	Allocator	allocator;
+	size_t		limit;	// 0 for no limit
+	MemoryStats	stats;
+};
+
+static void* _reallocateDefault(Allocator* allocator, void* memory, size_t size, uint8_t subsystem) {
+	(void)allocator;
+	(void)subsystem;
+	if (size == 0) {
+		free(memory);
+		return NULL;
+	}
+	return realloc(memory, size);
+}
+
+static void _peak(size_t* peak, size_t live) {
+	size_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+	while (live > seen
+		&& !__atomic_compare_exchange_n(peak, &seen, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+static void _count(MemoryStats* stats, uint8_t subsystem, ssize_t bytes) {
+	_peak(&stats->peak[subsystem], __atomic_add_fetch(&stats->live[subsystem], bytes, __ATOMIC_RELAXED));
+	_peak(&stats->totalPeak, __atomic_add_fetch(&stats->totalLive, bytes, __ATOMIC_RELAXED));
+}
+
+static void* _reallocateTracking(Allocator* allocator, void* memory, size_t size, uint8_t subsystem) {
+	Tracking* tracking = (Tracking*)allocator;
+	Header* header = memory == NULL ? NULL : (Header*)memory - 1;
+	const size_t oldSize = header == NULL ? 0 : header->size;
+	if (header != NULL) {
+		// The block stays counted where it was first allocated
+		subsystem = header->subsystem;
+	}
+	if (size == 0) {
+		_count(&tracking->stats, subsystem, -(ssize_t)oldSize);
+		free(header);
+		return NULL;
+	}
+	const ssize_t growth = (ssize_t)size - (ssize_t)oldSize;
+	_count(&tracking->stats, subsystem, growth);
+	if (tracking->limit != 0 && growth > 0
+		&& __atomic_load_n(&tracking->stats.totalLive, __ATOMIC_RELAXED) > tracking->limit) {
+		_count(&tracking->stats, subsystem, -growth);
+		return NULL;
+	}
+	Header* result = realloc(header, sizeof *result + size);
+	if (result == NULL) {
+		_count(&tracking->stats, subsystem, -growth);
+		return NULL;
+	}
+	result->size = size;
+	result->subsystem = subsystem;
+	return result + 1;
+}
+
+static Allocator defaultAllocator = { .reallocate = _reallocateDefault };
+static Tracking trackingAllocator = { .allocator.reallocate = _reallocateTracking };
+static Allocator* current = &defaultAllocator;
+
+// Must be called before anything is allocated
+void memoryUse(Allocator* allocator) {
+	current = allocator;
+}
+
+Allocator* memoryDefaultAllocator(void) {
+	return &defaultAllocator;
+}
+
+// Counts the live and peak bytes of every subsystem, see memoryStats()
+Allocator* memoryTrackingAllocator(void) {
+	trackingAllocator.limit = 0;
+	return &trackingAllocator.allocator;
+}
+
+// Tracking allocator that fails allocations once 'limit' bytes are live
+Allocator* memoryBudgetedAllocator(size_t limit) {
+	trackingAllocator.limit = limit;
+	return &trackingAllocator.allocator;
+}
+
+MemoryStats memoryStats(void) {
+	return trackingAllocator.stats;
+}
+
+__attribute__((noreturn)) static void _outOfMemory(size_t size) {
+	if (current == &trackingAllocator.allocator && trackingAllocator.limit != 0) {
+		fprintf(stderr, "Error: Memory limit of %zu bytes exceeded\n", trackingAllocator.limit);
+	}
+	else {
+		fprintf(stderr, "Error: Out of memory allocating %zu bytes\n", size);
+	}
+	exit(EXIT_FAILURE);
+}
+
+void* memoryAllocate(size_t size, uint8_t subsystem) {
+	return memoryReallocate(NULL, size, subsystem);
+}
+
+void* memoryAllocateZeroed(size_t size, uint8_t subsystem) {
+	void* memory = memoryAllocate(size, subsystem);
+	memset(memory, 0, size);
+	return memory;
+}
+
+void* memoryReallocate(void* memory, size_t size, uint8_t subsystem) {
+	// Zero sized blocks would be indistinguishable from a free
+	void* result = current->reallocate(current, memory, size == 0 ? 1 : size, subsystem);
+	if (result == NULL) {
+		_outOfMemory(size);
+	}
+	return result;
+}
+
+void memoryFree(void* memory) {
+	if (memory != NULL) {
+		current->reallocate(current, memory, 0, 0);
+	}
+}
@@ -0,0 +1,177 @@
+#define _DEFAULT_SOURCE
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// NOTE:	Modules are files of functions that a script imports with 'import "path.aa"' and calls with
+//			'name.function(...)', where 'name' is the file name without its extension
+//			- A module is read, parsed, resolved and inferred once per process, however many files import it,
+//			  importers only point their calls at its function nodes
+//			- Nothing that an importer does changes a module: its bodies are parsed right away, and its
+//			  parameters are inferred as unknown (see inferModule()), so quickening only depends on the module
+//			- Paths are relative to the importing file, those of the main script to its directory (see
+//			  moduleSetMainPath()) or to the working directory when it was not read from a file
+//			- Importing a module that is still being loaded is a cycle
+//			- Modules only contain functions and imports, they have no globals of their own
+typedef struct Loading	Loading;
+struct Loading {
+	char*		path;
+	ParseNode*	root;	// NULL until the module is parsed
+};
+
+static Module** modules = NULL;
+static size_t moduleCount = 0;
+static size_t moduleCapacity = 0;
+static Loading* loading = NULL;	// Modules being loaded, the innermost last
+static size_t loadingCount = 0;
+static size_t loadingCapacity = 0;
+static char mainDirectory[PATH_MAX] = ".";
+
+static void _directoryOf(const char* path, char* directory) {
+	const char* slash = strrchr(path, '/');
+	if (slash == NULL) {
+		strcpy(directory, ".");
+		return;
+	}
+	snprintf(directory, PATH_MAX, "%.*s", slash == path ? 1 : (int)(slash - path), path);
+}
+
+void moduleSetMainPath(const char* path) {
+	_directoryOf(path, mainDirectory);
+}
+
+static char* _read(const char* path, size_t* size) {
+	const int file = open(path, O_RDONLY);
+	struct stat s;
+	if (file == -1 || fstat(file, &s) != 0 || !S_ISREG(s.st_mode)) {
+		fprintf(stderr, "Error: Failed to open file '%s'\n", path);
+		if (file != -1) {
+			close(file);
+		}
+		return NULL;
+	}
+	char* chars = memoryAllocate(s.st_size, MEMORY_SOURCE);
+	size_t done = 0;
+	while (done < (size_t)s.st_size) {
+		const ssize_t length = read(file, chars + done, s.st_size - done);
+		if (length <= 0) {
+			break;
+		}
+		done += length;
+	}
+	close(file);
+	*size = done;
+	return chars;
+}
+
+static uint64_t _name(const char* path) {
+	const char* slash = strrchr(path, '/');
+	const char* begin = slash == NULL ? path : slash + 1;
+	const char* dot = strrchr(begin, '.');
+	return hash((const uint8_t*)begin, dot == NULL ? strlen(begin) : (size_t)(dot - begin));
+}
+
+static void _popLoading(void) {
+	Loading* top = &loading[--loadingCount];
+	if (top->root != NULL) {
+		parseTreeFree(top->root);
+		memoryFree(top->root);
+	}
+	memoryFree(top->path);
+}
+
+// Parses and resolves the module at the top of the loading stack, returns NULL after an error
+static ParseNode* _load(const char* path) {
+	size_t size;
+	char* chars = _read(path, &size);
+	if (chars == NULL) {
+		return NULL;
+	}
+	TokenList list;
+	const bool tokenized = tokenizeChecked(chars, size, false, &list);
+	memoryFree(chars);
+	if (!tokenized) {
+		return NULL;
+	}
+	ParseNode* root = parseProgram(&list, false);
+	if (root == NULL) {
+		return NULL;
+	}
+	loading[loadingCount - 1].root = root;
+	for (uint32_t i = 0; i < root->childCount; ++i) {
+		if (root->children[i].syntax != SYNTAX_FUNCTION && root->children[i].syntax != SYNTAX_IMPORT) {
+			fprintf(stderr, "Error: Module '%s' can only contain functions and imports\n", path);
+			return NULL;
+		}
+	}
+	// Errors end the process, or jump to resolveProgramChecked(), which calls moduleAbandon()
+	resolveModule(root);
+	inferModule(root);
+	return root;
+}
+
+// Returns NULL after reporting an error
+const Module* moduleImport(const char* path) {
+	char directory[PATH_MAX];
+	if (loadingCount == 0) {
+		strcpy(directory, mainDirectory);
+	}
+	else {
+		_directoryOf(loading[loadingCount - 1].path, directory);
+	}
+	char joined[PATH_MAX * 2];
+	snprintf(joined, sizeof joined, "%s/%s", path[0] == '/' ? "" : directory, path);
+	char canonical[PATH_MAX];
+	if (realpath(joined, canonical) == NULL) {
+		fprintf(stderr, "Error: Failed to open file '%s'\n", joined);
+		return NULL;
+	}
+	for (size_t i = 0; i < moduleCount; ++i) {
+		if (strcmp(modules[i]->path, canonical) == 0) {
+			return modules[i];
+		}
+	}
+	for (size_t i = 0; i < loadingCount; ++i) {
+		if (strcmp(loading[i].path, canonical) == 0) {
+			fprintf(stderr, "Error: Import cycle through '%s'\n", canonical);
+			return NULL;
+		}
+	}
+	if (loadingCount == loadingCapacity) {
+		loadingCapacity = loadingCapacity == 0 ? 8 : loadingCapacity * 2;
+		loading = memoryReallocate(loading, loadingCapacity * sizeof *loading, MEMORY_ANALYSIS);
+	}
+	const size_t length = strlen(canonical);
+	Loading* top = &loading[loadingCount++];
+	top->path = memoryAllocate(length + 1, MEMORY_SYNTAX_TREE);
+	memcpy(top->path, canonical, length + 1);
+	top->root = NULL;
+	ParseNode* root = _load(canonical);
+	if (root == NULL) {
+		_popLoading();
+		return NULL;
+	}
+	Module* module = memoryAllocate(sizeof *module, MEMORY_SYNTAX_TREE);
+	module->path = loading[--loadingCount].path;
+	module->name = _name(module->path);
+	module->root = root;
+	if (moduleCount == moduleCapacity) {
+		moduleCapacity = moduleCapacity == 0 ? 8 : moduleCapacity * 2;
+		modules = memoryReallocate(modules, moduleCapacity * sizeof *modules, MEMORY_SYNTAX_TREE);
+	}
+	modules[moduleCount++] = module;
+	return module;
+}
+
+// Drops the modules whose loading was cut short by an error, those that were loaded are kept
+void moduleAbandon(void) {
+	while (loadingCount != 0) {
+		_popLoading();
+	}
+}
@@ -0,0 +1,467 @@
+#define _DEFAULT_SOURCE
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INITIAL_NATIVE_CAPACITY	32
+#define LINE_BUFFER_SIZE	(1024 * 1024)
+#define OUTPUT_BUFFER_SIZE	(64 * 1024)
+#define CURSOR_SLOT_BITS	32
+#define CURSOR_VERSION_MASK	0x7fffffff	// Keeps cursors positive
+
+// NOTE:	Native functions are C functions callable from scripts
+//			- They are registered by name, which is stored as its hash() like every identifier
+//			- resolveProgram() binds calls to them, so a call goes straight to the function pointer, unless the
+//			  script defines a function of the same name
+//			- The arguments stay on the value stack during the call, natives must not keep the pointer
+//			- Registering a name again replaces the previous function for later programs, calls that are bound
+//			  already keep the Native they point to, so a replaced Native is never freed
+//			- The standard functions below are registered before anything else
+static Native** natives = NULL;	// Every Native is allocated on its own, so that pointers to it stay valid
+static size_t nativeCount = 0;
+static size_t nativeCapacity = 0;
+static bool initialized = false;
+
+// NOTE:	Input and output for scripts that process data
+//			- read_file() maps the file and returns the mapping as the string, nothing is copied, the mapping
+//			  has a zero page after the contents so that it ends like a C string, and the collector unmaps it
+//			  once no string points into it (see gcAddRegion())
+//			- read_line() returns the next line of stdin without its '\n', or None at the end, the line points
+//			  into a large chunk of input and reading it allocates nothing
+//			- Bytes of a chunk never move, a line that does not fit is copied to the start of a new chunk, and
+//			  the old chunk is handed to the collector with the lines that were returned from it
+//			- write() to fd 1 or 2 goes through stdout or stderr like print(), other descriptors have a buffer
+//			  that is written when it is full, when another descriptor is written or at exit
+//			- Strings end at their first '\0', files that contain one are cut short
+static char* lines = NULL;	// The chunk being read into
+static size_t lineCapacity = 0;
+static size_t lineBegin = 0;	// Of the unread part of 'lines'
+static size_t lineEnd = 0;		// Of the bytes read into 'lines'
+static bool inputEnded = false;
+static char output[OUTPUT_BUFFER_SIZE];
+static size_t outputCount = 0;
+static int outputFd = -1;
+
+static void printData(Data d, bool quoteStrings) {
+	switch (d.type) {
+	case TYPE_INTEGER:
+		printf("%li", d.integer);
+		break;
+	case TYPE_BIGINT:
+		bigintPrint(d.bigint);
+		break;
+	case TYPE_STRING:
+		printf(quoteStrings ? "\"%s\"" : "%s", d.string);
+		break;
+	case TYPE_MAP:
+		putchar('{');
+		for (size_t it = mapNext(d.map, 0); it != 0; it = mapNext(d.map, it)) {
+			printData(mapKeyAt(d.map, it), true);
+			printf(": ");
+			printData(mapValueAt(d.map, it), true);
+			if (mapNext(d.map, it) != 0) {
+				printf(", ");
+			}
+		}
+		putchar('}');
+		break;
+	case TYPE_COROUTINE:
+		printf("<generator>");
+		break;
+	case TYPE_VOID:
+	case TYPE_NONE:
+	default:
+		printf("None");
+		break;
+	}
+}
+
+static Map* _expectMap(Data d) {
+	if (d.type != TYPE_MAP) {
+		fprintf(stderr, "Error: Expected a map\n");
+		exit(EXIT_FAILURE);
+	}
+	return d.map;
+}
+
+static Coroutine* _expectCoroutine(Data d) {
+	if (d.type != TYPE_COROUTINE) {
+		fprintf(stderr, "Error: Expected a generator\n");
+		exit(EXIT_FAILURE);
+	}
+	return d.coroutine;
+}
+
+// NOTE:	The cursors of map_next(), map_key() and map_value() are the slot of mapNext() in the low bits and the
+//			version of the map in the high bits, 0 stays the start and the end
+//			- A map that has gained or lost a key since the cursor was made may have moved its entries, using the
+//			  cursor then is an error rather than visiting an entry twice or skipping one
+//			- Values of existing keys can be replaced while iterating
+static size_t _expectCursor(const Map* map, Data d) {
+	if (d.type != TYPE_INTEGER || d.integer < 0) {
+		fprintf(stderr, "Error: Expected a map cursor\n");
+		exit(EXIT_FAILURE);
+	}
+	const uint64_t cursor = (uint64_t)d.integer;
+	if (cursor != 0 && cursor >> CURSOR_SLOT_BITS != (mapVersion(map) & CURSOR_VERSION_MASK)) {
+		fprintf(stderr, "Error: Map changed during iteration\n");
+		exit(EXIT_FAILURE);
+	}
+	return cursor & (((uint64_t)1 << CURSOR_SLOT_BITS) - 1);
+}
+
+static Data _cursor(const Map* map, size_t slot) {
+	Data result = { .type = TYPE_INTEGER, .integer = 0 };
+	if (slot != 0) {
+		assert(slot >> CURSOR_SLOT_BITS == 0);
+		result.integer = (int64_t)((uint64_t)(mapVersion(map) & CURSOR_VERSION_MASK) << CURSOR_SLOT_BITS | slot);
+	}
+	return result;
+}
+
+static Data _expectNumber(Data d) {
+	if (d.type != TYPE_INTEGER && d.type != TYPE_BIGINT) {
+		fprintf(stderr, "Error: Expected an integer\n");
+		exit(EXIT_FAILURE);
+	}
+	return d;
+}
+
+static const char* _expectString(Data d) {
+	if (d.type != TYPE_STRING) {
+		fprintf(stderr, "Error: Expected a string\n");
+		exit(EXIT_FAILURE);
+	}
+	return d.string;
+}
+
+static Data _integer(int64_t value) {
+	Data result = { .type = TYPE_INTEGER, .integer = value };
+	return result;
+}
+
+static Data stdPrint(const Data* args, uint16_t argCount) {
+	Data result = {};
+	for (uint16_t i = 0; i < argCount; ++i) {
+		if (i > 0) {
+			putchar(' ');
+		}
+		printData(args[i], false);
+	}
+	putchar('\n');
+	return result;
+}
+
+static Data stdLen(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	return _integer(strlen(_expectString(args[0])));
+}
+
+static Data stdAbs(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	const Data x = _expectNumber(args[0]);
+	if (bigintCompare(x, _integer(0)) >= 0) {
+		return x;
+	}
+	// The argument stays on the value stack, and -INT64_MIN becomes a Bigint
+	return bigintArithmetic(TOKEN_MINUS, _integer(0), x);
+}
+
+static Data stdMin(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	return bigintCompare(_expectNumber(args[0]), _expectNumber(args[1])) <= 0 ? args[0] : args[1];
+}
+
+static Data stdMax(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	return bigintCompare(_expectNumber(args[0]), _expectNumber(args[1])) >= 0 ? args[0] : args[1];
+}
+
+static Data stdMap(const Data* args, uint16_t argCount) {
+	(void)args;
+	(void)argCount;
+	Data result = { .type = TYPE_MAP };
+	result.map = mapCreate();
+	return result;
+}
+
+static Data stdMapGet(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	return mapGet(_expectMap(args[0]), args[1]);
+}
+
+static Data stdMapSet(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	mapSet(_expectMap(args[0]), args[1], args[2]);
+	Data result = {};
+	return result;
+}
+
+static Data stdMapDelete(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	return _integer(mapDelete(_expectMap(args[0]), args[1]));
+}
+
+static Data stdMapHas(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	return _integer(mapContains(_expectMap(args[0]), args[1]));
+}
+
+static Data stdMapSize(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	return _integer(mapSize(_expectMap(args[0])));
+}
+
+static Data stdMapNext(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	const Map* map = _expectMap(args[0]);
+	return _cursor(map, mapNext(map, _expectCursor(map, args[1])));
+}
+
+static Data stdMapKey(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	const Map* map = _expectMap(args[0]);
+	return mapKeyAt(map, _expectCursor(map, args[1]));
+}
+
+static Data stdMapValue(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	const Map* map = _expectMap(args[0]);
+	return mapValueAt(map, _expectCursor(map, args[1]));
+}
+
+static Data stdNext(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	return coroutineResume(_expectCoroutine(args[0]));
+}
+
+static Data stdDone(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	return _integer(coroutineDone(_expectCoroutine(args[0])));
+}
+
+static Data stdSpawn(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	schedulerSpawn(_expectCoroutine(args[0]));
+	return args[0];
+}
+
+static Data stdRun(const Data* args, uint16_t argCount) {
+	(void)args;
+	(void)argCount;
+	schedulerRun();
+	Data result = { .type = TYPE_VOID };
+	return result;
+}
+
+static void _unmap(void* memory, size_t size) {
+	munmap(memory, size);
+}
+
+static void _freeChunk(void* memory, size_t size) {
+	(void)size;
+	memoryFree(memory);
+}
+
+static Data stdReadFile(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	const char* path = _expectString(args[0]);
+	const int file = open(path, O_RDONLY);
+	struct stat s;
+	if (file == -1 || fstat(file, &s) != 0 || !S_ISREG(s.st_mode)) {
+		fprintf(stderr, "Error: Failed to open file '%s'\n", path);
+		exit(EXIT_FAILURE);
+	}
+	// The file is mapped over the start of a larger anonymous mapping, whose pages are zero
+	const size_t page = sysconf(_SC_PAGESIZE);
+	const size_t size = s.st_size;
+	const size_t mapped = (size / page + 1) * page;
+	char* view = mmap(NULL, mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (view == MAP_FAILED
+		|| (size != 0 && mmap(view, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, file, 0) == MAP_FAILED)) {
+		fprintf(stderr, "Error: Failed to map file '%s'\n", path);
+		exit(EXIT_FAILURE);
+	}
+	close(file);
+	madvise(view, size, MADV_SEQUENTIAL);
+	gcAddRegion(view, mapped, _unmap);
+	Data result = { .type = TYPE_STRING, .string = view };
+	return result;
+}
+
+// Returns NULL at the end of stdin
+static const char* _readLine(void) {
+	while (true) {
+		char* newline = lineBegin == lineEnd ? NULL : memchr(lines + lineBegin, '\n', lineEnd - lineBegin);
+		if (newline != NULL) {
+			*newline = '\0';
+			const char* line = lines + lineBegin;
+			lineBegin = newline + 1 - lines;
+			return line;
+		}
+		if (inputEnded) {
+			if (lineBegin == lineEnd) {
+				return NULL;
+			}
+			// Last line without a '\n', there is always room for the '\0'
+			lines[lineEnd] = '\0';
+			const char* line = lines + lineBegin;
+			lineBegin = lineEnd;
+			return line;
+		}
+		if (lineCapacity - lineEnd <= 1) {
+			const size_t unread = lineEnd - lineBegin;
+			const size_t capacity = unread * 2 > LINE_BUFFER_SIZE ? unread * 2 : LINE_BUFFER_SIZE;
+			char* chunk = memoryAllocate(capacity, MEMORY_HEAP);
+			if (unread != 0) {
+				memcpy(chunk, lines + lineBegin, unread);
+			}
+			// Nothing points into a chunk that no line was returned from
+			if (lineBegin == 0) {
+				memoryFree(lines);
+			}
+			else {
+				gcAddRegion(lines, lineCapacity, _freeChunk);
+			}
+			lines = chunk;
+			lineCapacity = capacity;
+			lineBegin = 0;
+			lineEnd = unread;
+		}
+		const ssize_t length = read(STDIN_FILENO, lines + lineEnd, lineCapacity - lineEnd - 1);
+		if (length < 0) {
+			fprintf(stderr, "Error: Failed to read stdin\n");
+			exit(EXIT_FAILURE);
+		}
+		inputEnded = length == 0;
+		lineEnd += length;
+	}
+}
+
+static Data stdReadLine(const Data* args, uint16_t argCount) {
+	(void)args;
+	(void)argCount;
+	const char* line = _readLine();
+	Data result = { .type = line == NULL ? TYPE_NONE : TYPE_STRING, .string = line };
+	return result;
+}
+
+static void _writeAll(int fd, const char* chars, size_t count) {
+	while (count != 0) {
+		const ssize_t length = write(fd, chars, count);
+		if (length <= 0) {
+			fprintf(stderr, "Error: Failed to write to file descriptor %i\n", fd);
+			exit(EXIT_FAILURE);
+		}
+		chars += length;
+		count -= length;
+	}
+}
+
+void nativeFlush(void) {
+	_writeAll(outputFd, output, outputCount);
+	outputCount = 0;
+}
+
+static Data stdWrite(const Data* args, uint16_t argCount) {
+	(void)argCount;
+	if (args[0].type != TYPE_INTEGER || args[0].integer < 0 || args[0].integer > INT32_MAX) {
+		fprintf(stderr, "Error: Expected a file descriptor\n");
+		exit(EXIT_FAILURE);
+	}
+	const int fd = args[0].integer;
+	const char* chars = _expectString(args[1]);
+	const size_t count = strlen(chars);
+	if (fd == STDOUT_FILENO || fd == STDERR_FILENO) {
+		fwrite(chars, 1, count, fd == STDOUT_FILENO ? stdout : stderr);
+		return _integer(count);
+	}
+	if (outputFd == -1) {
+		atexit(nativeFlush);
+	}
+	if (fd != outputFd || outputCount + count > OUTPUT_BUFFER_SIZE) {
+		nativeFlush();
+		outputFd = fd;
+	}
+	if (count >= OUTPUT_BUFFER_SIZE) {
+		_writeAll(fd, chars, count);
+	}
+	else {
+		memcpy(output + outputCount, chars, count);
+		outputCount += count;
+	}
+	return _integer(count);
+}
+
+static void _add(const char* name, NativeFunction function, int16_t arity, uint8_t flags, uint8_t result) {
+	const uint64_t identifier = hash((const uint8_t*)name, strlen(name));
+	Native* native = memoryAllocate(sizeof *native, MEMORY_ANALYSIS);
+	size_t i = 0;
+	while (i < nativeCount && natives[i]->identifier != identifier) {
+		++i;
+	}
+	if (i == nativeCount) {
+		if (nativeCount == nativeCapacity) {
+			nativeCapacity = nativeCapacity == 0 ? INITIAL_NATIVE_CAPACITY : nativeCapacity * 2;
+			natives = memoryReallocate(natives, nativeCapacity * sizeof *natives, MEMORY_ANALYSIS);
+		}
+		++nativeCount;
+	}
+	natives[i] = native;
+	native->identifier = identifier;
+	native->function = function;
+	native->arity = arity;
+	native->flags = flags;
+	native->result = result;
+}
+
+static void _registerStandard(void) {
+	initialized = true;
+	_add("print", stdPrint, NATIVE_ANY_ARITY, 0, INFERRED_UNKNOWN);
+	_add("len", stdLen, 1, NATIVE_PURE, INFERRED_INTEGER);
+	_add("abs", stdAbs, 1, NATIVE_PURE, INFERRED_INTEGER);
+	_add("min", stdMin, 2, NATIVE_PURE, INFERRED_INTEGER);
+	_add("max", stdMax, 2, NATIVE_PURE, INFERRED_INTEGER);
+	_add("map", stdMap, 0, 0, INFERRED_UNKNOWN);
+	_add("map_get", stdMapGet, 2, 0, INFERRED_UNKNOWN);
+	_add("map_set", stdMapSet, 3, NATIVE_MUTATES, INFERRED_UNKNOWN);
+	_add("map_delete", stdMapDelete, 2, NATIVE_MUTATES, INFERRED_INTEGER);
+	_add("map_has", stdMapHas, 2, 0, INFERRED_INTEGER);
+	_add("map_size", stdMapSize, 1, 0, INFERRED_INTEGER);
+	_add("map_next", stdMapNext, 2, 0, INFERRED_INTEGER);
+	_add("map_key", stdMapKey, 2, 0, INFERRED_UNKNOWN);
+	_add("map_value", stdMapValue, 2, 0, INFERRED_UNKNOWN);
+	_add("next", stdNext, 1, NATIVE_RUNS_SCRIPT, INFERRED_UNKNOWN);
+	_add("done", stdDone, 1, 0, INFERRED_INTEGER);
+	_add("spawn", stdSpawn, 1, NATIVE_RUNS_SCRIPT, INFERRED_UNKNOWN);
+	_add("run", stdRun, 0, NATIVE_RUNS_SCRIPT, INFERRED_UNKNOWN);
+	_add("read_file", stdReadFile, 1, 0, INFERRED_STRING);
+	_add("read_line", stdReadLine, 0, NATIVE_SERIAL, INFERRED_UNKNOWN);
+	_add("write", stdWrite, 2, NATIVE_SERIAL, INFERRED_INTEGER);
+}
+
+void nativeRegister(const char* name, NativeFunction function, int16_t arity, uint8_t flags, uint8_t result) {
+	if (!initialized) {
+		_registerStandard();
+	}
+	_add(name, function, arity, flags, result);
+}
+
+const Native* nativeFind(uint64_t identifier) {
+	if (!initialized) {
+		_registerStandard();
+	}
+	for (size_t i = 0; i < nativeCount; ++i) {
+		if (natives[i]->identifier == identifier) {
+			return natives[i];
+		}
+	}
+	return NULL;
+}
@@ -14,9 +14,9 @@
 //				- STAR means match 0 or more occurrences
 //				- QUESTION means match 0 or 1 occurrences, can also be used for functions that cannot fail
 // NOTE:	Parsing functions must have the same names for arguments 't', 'parent', and 'end'
-#define SAVE()						const Token* _savedT = *t;\
+#define SAVE()						const TokenCursor _savedT = *t;\
 									ParseNode* _savedParent = parent;\
-									const uint16_t _savedChildCount = parent->childCount;\
+									const uint32_t _savedChildCount = parent->childCount;\
 									(void)_savedT; (void)_savedParent; (void)_savedChildCount
 #define PUSH(s)						parent = parseNodePushChild(parent, s)
 #define FAIL()						parseNodePopChild(_savedParent);\
@@ -36,38 +36,76 @@
 #define SUCCEED_IF_MERGE(func)		if (func(t, end, parent)) { SUCCEED_MERGE(); }
 #define SUCCEED_IF_T_MERGE(tok)		if (parseToken(t, end, parent, tok)) { SUCCEED_MERGE(); }
 
-static bool parseToken(const Token** t, const Token* const end, ParseNode* parent, Syntax targetToken);
-static bool parseComponent(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseFunction(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseBlock(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseLine(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseDeclaration(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseAssignment(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseFunctionCall(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseParameterList(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseArgumentList(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseReturn(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseControlStructure(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseIf(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseWhile(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseExpression(const Token** t, const Token* const end, ParseNode* parent);
-static bool parseUnaryExpression(const Token** t, const Token* const end, ParseNode* parent);
-static bool parsePrimaryExpression(const Token** t, const Token* const end, ParseNode* parent);
-
-static void parseNodeCreate(ParseNode* node, Syntax s) {
+// NOTE:	Top level functions of large programs are parsed in parallel, see parseProgram()
+//			- A prescan finds the 'fn' ... 'end' spans by counting the blocks opened by 'fn', 'if', 'while' and 'for'
+//			  ('else if' does not open a block)
+//			- A span is parsed on its own with 'end' at its last token, parsing never looks past the 'end' of a
+//			  function, so the node is the same one the sequential parse would produce
+//			- Spans that do not parse exactly are left to the sequential parse, which reports the error
+#define PARALLEL_MIN_TOKENS	(64 * 1024)
+#define SPANS_PER_TASK		64
+
+typedef struct Span	Span;
+struct Span {
+	TokenCursor		begin;
+	TokenCursor		end;
+	ParseNode		node;
+	bool			parsed;
+};
+
+// NOTE:	In lazy mode parseFunction() only copies the tokens of the body into a SYNTAX_LAZY_BLOCK
+//			- The matching 'end' is found by the same block counting as the prescan
+//			- resolveProgram() parses a body when it binds the first call to it, so functions that are never
+//			  called are never parsed
+//			- A body whose 'end' cannot be found is parsed right away, so that the error is reported
+//			- Libraries can have any number of functions, resolveProgram() finds a called function through a hash
+//			  table, so the cost of a skipped function is copying its tokens
+static bool lazyBodies = false;
+
+typedef struct SpanList	SpanList;
+struct SpanList {
+	Span*	spans;
+	size_t	count;
+	size_t	capacity;
+};
+
+static bool parseToken(TokenCursor* t, const Syntax* const end, ParseNode* parent, Syntax targetToken);
+static bool parseComponent(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseFunction(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseImport(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseBlock(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseLine(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseDeclaration(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseAssignment(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseIndexAssignment(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseFunctionCall(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseParameterList(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseArgumentList(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseReturn(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseYield(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseControlStructure(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseIf(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseWhile(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseFor(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseParallelFor(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseBench(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseExpression(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseUnaryExpression(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parsePrimaryExpression(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+static bool parseIndex(TokenCursor* t, const Syntax* const end, ParseNode* parent);
+
+void parseNodeCreate(ParseNode* node, Syntax s) {
 	memset(node, 0, sizeof *node);
 	node->syntax = s;
 	node->childCapacity = 2;
-	node->children = malloc(2 * sizeof *node->children);
+	node->children = memoryAllocate(2 * sizeof *node->children, MEMORY_SYNTAX_TREE);
 }
 
 static ParseNode* parseNodePushChild(ParseNode* parent, Syntax s) {
-	assert(parent->childCount < UINT16_MAX);
 	if (parent->childCount == parent->childCapacity) {
-		assert(!(parent->childCapacity & 0x8000));
 		parent->childCapacity *= 2;
-		parent->children = realloc(parent->children, (size_t)parent->childCapacity * sizeof *parent->children);
-		assert(parent->children != NULL);
+		parent->children = memoryReallocate(parent->children, (size_t)parent->childCapacity * sizeof *parent->children,
+			MEMORY_SYNTAX_TREE);
 	}
 	ParseNode* child = &parent->children[parent->childCount++];
 	parseNodeCreate(child, s);
@@ -75,11 +113,12 @@ static ParseNode* parseNodePushChild(ParseNode* parent, Syntax s) {
 }
 
 static void _tryShrink(ParseNode* parent) {
-	if (parent->childCapacity < 4 || parent->childCapacity < parent->childCount * 3) {
+	if (parent->childCapacity < 4 || parent->childCapacity < (size_t)parent->childCount * 3) {
 		return;
 	}
 	parent->childCapacity /= 2;
-	parent->children = realloc(parent->children, parent->childCapacity * sizeof *parent->children);
+	parent->children = memoryReallocate(parent->children, (size_t)parent->childCapacity * sizeof *parent->children,
+		MEMORY_SYNTAX_TREE);
 }
 
 static void parseNodePopChild(ParseNode* parent) {
@@ -89,7 +128,7 @@ static void parseNodePopChild(ParseNode* parent) {
 	_tryShrink(parent);
 }
 
-void parseNodeRemoveChild(ParseNode* parent, uint16_t i) {
+void parseNodeRemoveChild(ParseNode* parent, uint32_t i) {
 	assert(i < parent->childCount);
 	--parent->childCount;
 	parseTreeFree(&parent->children[i]);
@@ -101,36 +140,199 @@ static void parseNodeMerge(ParseNode* parent) {
 	assert(parent->childCount == 1);
 	void* temp = parent->children;
 	*parent = parent->children[0];
-	free(temp);
+	memoryFree(temp);
 }
 
 void parseTreeFree(ParseNode* root) {
 	if (root->syntax == TOKEN_STRING) {
-		free((void*)root->data.stringLiteral);
+		memoryFree((void*)root->data.stringLiteral);
 	}
-	for (uint16_t i = 0; i < root->childCount; ++i) {
+	else if (root->syntax == SYNTAX_LAZY_BLOCK) {
+		// The string literals have not been moved into nodes
+		const TokenData* data = root->tokens->data;
+		for (size_t i = 0; i < root->tokens->tokenCount; ++i) {
+			if (root->tokens->syntax[i] == TOKEN_STRING) {
+				memoryFree((void*)data->stringLiteral);
+			}
+			data += TOKEN_HAS_DATA(root->tokens->syntax[i]);
+		}
+		memoryFree(root->tokens->syntax);
+		memoryFree(root->tokens->data);
+		memoryFree(root->tokens);
+	}
+	for (uint32_t i = 0; i < root->childCount; ++i) {
 		parseTreeFree(&root->children[i]);
 	}
-	free(root->children);
+	memoryFree(root->children);
 }
 
-ParseNode* parseProgram(const TokenList* list) {
-	const Token* t = list->tokens;
-	const Token* const end = list->tokens + list->tokenCount;
-	ParseNode* root = malloc(sizeof *root);
+static void _addSpan(SpanList* list, TokenCursor begin, TokenCursor end) {
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+		list->spans = memoryReallocate(list->spans, list->capacity * sizeof *list->spans, MEMORY_SYNTAX_TREE);
+	}
+	Span* span = &list->spans[list->count++];
+	span->begin = begin;
+	span->end = end;
+	span->parsed = false;
+}
+
+static bool _opensBlock(const Syntax* t, const Syntax* const begin) {
+	switch (*t) {
+	case TOKEN_FN:
+	case TOKEN_WHILE:
+	case TOKEN_FOR:
+	case TOKEN_BENCH:
+		return true;
+	case TOKEN_IF:
+		return t == begin || t[-1] != TOKEN_ELSE;
+	default:
+		return false;
+	}
+}
+
+static SpanList _findFunctions(TokenCursor begin, const Syntax* const end) {
+	SpanList list = {};
+	TokenCursor function = {};
+	size_t depth = 0;
+	for (TokenCursor t = begin; t.syntax != end; t.data += TOKEN_HAS_DATA(*t.syntax), ++t.syntax) {
+		if (_opensBlock(t.syntax, begin.syntax)) {
+			if (depth == 0 && *t.syntax == TOKEN_FN) {
+				function = t;
+			}
+			++depth;
+		}
+		else if (*t.syntax == TOKEN_END && depth != 0 && --depth == 0 && function.syntax != NULL) {
+			// 'end' has no payload
+			const TokenCursor after = { .syntax = t.syntax + 1, .data = t.data };
+			_addSpan(&list, function, after);
+			function.syntax = NULL;
+		}
+	}
+	return list;
+}
+
+static void _parseSpans(void* context, size_t i) {
+	const SpanList* list = context;
+	const size_t last = (i + 1) * SPANS_PER_TASK < list->count ? (i + 1) * SPANS_PER_TASK : list->count;
+	for (Span* span = &list->spans[i * SPANS_PER_TASK]; span != &list->spans[last]; ++span) {
+		ParseNode holder;
+		parseNodeCreate(&holder, SYNTAX_PROGRAM);
+		TokenCursor t = span->begin;
+		if (parseFunction(&t, span->end.syntax, &holder) && t.syntax == span->end.syntax) {
+			span->node = holder.children[0];
+			span->parsed = true;
+			memoryFree(holder.children);
+		}
+		else {
+			parseTreeFree(&holder);
+		}
+	}
+}
+
+// Moves the body tokens up to the matching 'end' into a SYNTAX_LAZY_BLOCK
+static bool _skipBody(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
+	size_t depth = 1;
+	TokenCursor it = *t;
+	for (; it.syntax != end; it.data += TOKEN_HAS_DATA(*it.syntax), ++it.syntax) {
+		if (_opensBlock(it.syntax, t->syntax)) {
+			++depth;
+		}
+		else if (*it.syntax == TOKEN_END && --depth == 0) {
+			break;
+		}
+	}
+	if (it.syntax == end) {
+		return false;
+	}
+	TokenList* body = memoryAllocate(sizeof *body, MEMORY_TOKENS);
+	body->tokenCount = body->tokenCapacity = it.syntax - t->syntax;
+	body->dataCount = body->dataCapacity = it.data - t->data;
+	body->offsets = NULL;
+	body->syntax = memoryAllocate(body->tokenCount, MEMORY_TOKENS);
+	body->data = memoryAllocate(body->dataCount * sizeof *body->data, MEMORY_TOKENS);
+	memcpy(body->syntax, t->syntax, body->tokenCount);
+	memcpy(body->data, t->data, body->dataCount * sizeof *body->data);
+	parseNodePushChild(parent, SYNTAX_LAZY_BLOCK)->tokens = body;
+	*t = it;
+	return true;
+}
+
+// Replaces a SYNTAX_LAZY_BLOCK by the SYNTAX_BLOCK that its tokens parse to
+void parseLazyBlock(ParseNode* block) {
+	TokenList* body = block->tokens;
+	TokenCursor t = { .syntax = body->syntax, .data = body->data };
+	const Syntax* const end = body->syntax + body->tokenCount;
+	ParseNode holder;
+	parseNodeCreate(&holder, SYNTAX_FUNCTION);
+	if (!parseBlock(&t, end, &holder) || t.syntax != end) {
+		fprintf(stderr, "Error: Did not parse all tokens of a function\n");
+		exit(EXIT_FAILURE);
+	}
+	memoryFree(block->children);
+	*block = holder.children[0];
+	memoryFree(holder.children);
+	memoryFree(body->syntax);
+	memoryFree(body->data);
+	memoryFree(body);
+}
+
+ParseNode* parseProgram(const TokenList* list, bool lazy) {
+	TokenCursor t = { .syntax = list->syntax, .data = list->data };
+	const Syntax* const end = list->syntax + list->tokenCount;
+	ParseNode* root = memoryAllocate(sizeof *root, MEMORY_SYNTAX_TREE);
 	parseNodeCreate(root, SYNTAX_PROGRAM);
-	while (parseComponent(&t, end, root)) {
+	lazyBodies = lazy;
+	SpanList functions = {};
+	if (!lazy && list->tokenCount >= PARALLEL_MIN_TOKENS && poolThreadCount() > 1) {
+		functions = _findFunctions(t, end);
+		poolRun(_parseSpans, &functions, (functions.count + SPANS_PER_TASK - 1) / SPANS_PER_TASK);
 	}
-	free(list->tokens);
-	if (t != end) {
+	Span* span = functions.spans;
+	Span* const lastSpan = functions.spans + functions.count;
+	while (true) {
+		// Spans that the sequential parse went past were not functions after all
+		while (span != lastSpan && span->begin.syntax < t.syntax) {
+			if (span->parsed) {
+				parseTreeFree(&span->node);
+			}
+			++span;
+		}
+		if (span != lastSpan && span->begin.syntax == t.syntax && span->parsed) {
+			ParseNode* function = parseNodePushChild(root, SYNTAX_NONE);
+			memoryFree(function->children);
+			*function = span->node;
+			t = span->end;
+			++span;
+			continue;
+		}
+		if (!parseComponent(&t, end, root)) {
+			break;
+		}
+	}
+	for (; span != lastSpan; ++span) {
+		if (span->parsed) {
+			parseTreeFree(&span->node);
+		}
+	}
+	memoryFree(functions.spans);
+	memoryFree(list->syntax);
+	memoryFree(list->data);
+	if (t.syntax != end) {
 		fprintf(stderr, "Error: Did not parse all tokens\n");
 		parseTreeFree(root);
-		free(root);
+		memoryFree(root);
 		return NULL;
 	}
 	return root;
 }
 
+// Parses one top level component with its body, returns false at the end of the tokens or if they do not parse
+bool parseNextComponent(TokenCursor* t, const Syntax* const end, ParseNode* root) {
+	lazyBodies = false;
+	return parseComponent(t, end, root);
+}
+
 static void _parseTreePrint(const ParseNode* root, int depth) {
 	for (int i = 0; i < depth; ++i) {
 		putchar(' ');
@@ -143,8 +345,25 @@ static void _parseTreePrint(const ParseNode* root, int depth) {
 	else if (root->syntax == TOKEN_STRING) {
 		printf(" \"%s\"", root->data.stringLiteral);
 	}
+	else if (root->syntax == RUNTIME_KNOWN_VARIABLE || root->syntax == RUNTIME_KNOWN_GLOBAL_VARIABLE) {
+		printf(" %zd", root->stackIndex);
+	}
+	else if (root->syntax == RUNTIME_COUNTED_WHILE) {
+		printf(" step %li", root->data.integerLiteral);
+	}
+	switch (root->inferred) {
+	case INFERRED_INTEGER:
+		printf(" : integer");
+		break;
+	case INFERRED_STRING:
+		printf(" : string");
+		break;
+	case INFERRED_UNKNOWN:
+		printf(" : unknown");
+		break;
+	}
 	putchar('\n');
-	for (uint16_t i = 0; i < root->childCount; ++i) {
+	for (uint32_t i = 0; i < root->childCount; ++i) {
 		_parseTreePrint(&root->children[i], depth + 1);
 	}
 }
@@ -153,15 +372,24 @@ void parseTreePrint(const ParseNode* root) {
 	_parseTreePrint(root, 0);
 }
 
-bool parseComponent(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseComponent(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	SUCCEED_IF(parseFunction);
+	SUCCEED_IF(parseImport);
 	SUCCEED_IF(parseLine);
 	SUCCEED_IF(parseControlStructure);
 	FAIL_NO_POP();
 }
 
-bool parseFunction(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseImport(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
+	SAVE();
+	PUSH(SYNTAX_IMPORT);
+	FAIL_IF_NOT_T(TOKEN_IMPORT);
+	FAIL_IF_NOT_T(TOKEN_STRING);
+	SUCCEED();
+}
+
+bool parseFunction(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	PUSH(SYNTAX_FUNCTION);
 	FAIL_IF_NOT_T(TOKEN_FN);
@@ -169,42 +397,46 @@ bool parseFunction(const Token** t, const Token* const end, ParseNode* parent) {
 	FAIL_IF_NOT_T(TOKEN_L_PAREN);
 	QUESTION(parseParameterList);
 	FAIL_IF_NOT_T(TOKEN_R_PAREN);
-	QUESTION(parseBlock);
+	if (!lazyBodies || !_skipBody(t, end, parent)) {
+		QUESTION(parseBlock);
+	}
 	FAIL_IF_NOT_T(TOKEN_END);
 	SUCCEED();
 }
 
-bool _parseInnerComponent(const Token** t, const Token* const end, ParseNode* parent) {
+bool _parseInnerComponent(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	SUCCEED_IF(parseLine);
 	SUCCEED_IF(parseControlStructure);
 	FAIL_NO_POP();
 }
 
-bool parseBlock(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseBlock(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	PUSH(SYNTAX_BLOCK);
 	STAR(_parseInnerComponent);
 	SUCCEED();
 }
 
-bool parseLine(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseLine(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	SUCCEED_IF(parseDeclaration);
 	SUCCEED_IF(parseAssignment);
+	SUCCEED_IF(parseIndexAssignment);
 	SUCCEED_IF(parseFunctionCall);
 	SUCCEED_IF(parseReturn);
+	SUCCEED_IF(parseYield);
 	FAIL_NO_POP();
 }
 
-static bool _parseAssignExpression(const Token** t, const Token* const end, ParseNode* parent) {
+static bool _parseAssignExpression(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	FAIL_IF_NOT_T_NO_POP(TOKEN_ASSIGN);
 	FAIL_IF_NOT_NO_POP(parseExpression);
 	SUCCEED();
 }
 
-bool parseDeclaration(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseDeclaration(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	PUSH(SYNTAX_DECLARATION);
 	FAIL_IF_NOT_T(TOKEN_VAR);
@@ -213,7 +445,7 @@ bool parseDeclaration(const Token** t, const Token* const end, ParseNode* parent
 	SUCCEED();
 }
 
-bool parseAssignment(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseAssignment(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	PUSH(SYNTAX_ASSIGNMENT);
 	FAIL_IF_NOT_T(TOKEN_IDENTIFIER);
@@ -222,24 +454,47 @@ bool parseAssignment(const Token** t, const Token* const end, ParseNode* parent)
 	SUCCEED();
 }
 
-bool parseFunctionCall(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseIndexAssignment(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
+	SAVE();
+	PUSH(SYNTAX_INDEX_ASSIGNMENT);
+	FAIL_IF_NOT_T(TOKEN_IDENTIFIER);
+	FAIL_IF_NOT_T(TOKEN_L_BRACKET);
+	FAIL_IF_NOT(parseExpression);
+	FAIL_IF_NOT_T(TOKEN_R_BRACKET);
+	FAIL_IF_NOT_T(TOKEN_ASSIGN);
+	FAIL_IF_NOT(parseExpression);
+	SUCCEED();
+}
+
+// NOTE:	A call of a function of a module ('module.name(...)') keeps the module name as a third child, after the
+//			name and the arguments like any other call
+bool parseFunctionCall(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	PUSH(SYNTAX_FUNCTION_CALL);
 	FAIL_IF_NOT_T(TOKEN_IDENTIFIER);
+	if (parseToken(t, end, parent, TOKEN_DOT)) {
+		FAIL_IF_NOT_T(TOKEN_IDENTIFIER);
+	}
 	FAIL_IF_NOT_T(TOKEN_L_PAREN);
 	QUESTION(parseArgumentList);
 	FAIL_IF_NOT_T(TOKEN_R_PAREN);
+	if (parent->childCount == 3) {
+		const ParseNode module = parent->children[0];
+		parent->children[0] = parent->children[1];
+		parent->children[1] = parent->children[2];
+		parent->children[2] = module;
+	}
 	SUCCEED();
 }
 
-static bool _parseCommaIdentifier(const Token** t, const Token* const end, ParseNode* parent) {
+static bool _parseCommaIdentifier(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	FAIL_IF_NOT_T_NO_POP(TOKEN_COMMA);
 	FAIL_IF_NOT_T_NO_POP(TOKEN_IDENTIFIER);
 	SUCCEED();
 }
 
-bool parseParameterList(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseParameterList(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	PUSH(SYNTAX_PARAMETER_LIST);
 	if (!parseToken(t, end, parent, TOKEN_IDENTIFIER)) {
@@ -249,14 +504,14 @@ bool parseParameterList(const Token** t, const Token* const end, ParseNode* pare
 	SUCCEED();
 }
 
-static bool _parseCommaExpression(const Token** t, const Token* const end, ParseNode* parent) {
+static bool _parseCommaExpression(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	FAIL_IF_NOT_T_NO_POP(TOKEN_COMMA);
 	FAIL_IF_NOT_NO_POP(parseExpression);
 	SUCCEED();
 }
 
-bool parseArgumentList(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseArgumentList(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	PUSH(SYNTAX_ARGUMENT_LIST);
 	if (!parseExpression(t, end, parent)) {
@@ -266,7 +521,7 @@ bool parseArgumentList(const Token** t, const Token* const end, ParseNode* paren
 	SUCCEED();
 }
 
-bool parseReturn(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseReturn(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	PUSH(SYNTAX_RETURN);
 	FAIL_IF_NOT_T(TOKEN_RETURN);
@@ -274,14 +529,25 @@ bool parseReturn(const Token** t, const Token* const end, ParseNode* parent) {
 	SUCCEED();
 }
 
-bool parseControlStructure(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseYield(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
+	SAVE();
+	PUSH(SYNTAX_YIELD);
+	FAIL_IF_NOT_T(TOKEN_YIELD);
+	FAIL_IF_NOT(parseExpression);
+	SUCCEED();
+}
+
+bool parseControlStructure(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	SUCCEED_IF(parseIf);
 	SUCCEED_IF(parseWhile);
+	SUCCEED_IF(parseFor);
+	SUCCEED_IF(parseParallelFor);
+	SUCCEED_IF(parseBench);
 	FAIL_NO_POP();
 }
 
-static bool _parseElseIf(const Token** t, const Token* const end, ParseNode* parent) {
+static bool _parseElseIf(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	FAIL_IF_NOT_T_NO_POP(TOKEN_ELSE);
 	FAIL_IF_NOT_T_NO_POP(TOKEN_IF);
@@ -291,14 +557,14 @@ static bool _parseElseIf(const Token** t, const Token* const end, ParseNode* par
 	SUCCEED();
 }
 
-static bool _parseElseBlock(const Token** t, const Token* const end, ParseNode* parent) {
+static bool _parseElseBlock(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	FAIL_IF_NOT_T_NO_POP(TOKEN_ELSE);
 	QUESTION(parseBlock);
 	SUCCEED();
 }
 
-bool parseIf(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseIf(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	PUSH(SYNTAX_IF);
 	FAIL_IF_NOT_T(TOKEN_IF);
@@ -311,7 +577,7 @@ bool parseIf(const Token** t, const Token* const end, ParseNode* parent) {
 	SUCCEED();
 }
 
-bool parseWhile(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseWhile(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	PUSH(SYNTAX_WHILE);
 	FAIL_IF_NOT_T(TOKEN_WHILE);
@@ -322,7 +588,43 @@ bool parseWhile(const Token** t, const Token* const end, ParseNode* parent) {
 	SUCCEED();
 }
 
-static bool _parseParensExpression(const Token** t, const Token* const end, ParseNode* parent) {
+bool parseFor(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
+	SAVE();
+	PUSH(SYNTAX_FOR);
+	FAIL_IF_NOT_T(TOKEN_FOR);
+	FAIL_IF_NOT_T(TOKEN_IDENTIFIER);
+	FAIL_IF_NOT_T(TOKEN_ASSIGN);
+	FAIL_IF_NOT(parseExpression);
+	FAIL_IF_NOT_T(TOKEN_COMMA);
+	FAIL_IF_NOT(parseExpression);
+	FAIL_IF_NOT_T(TOKEN_DO);
+	QUESTION(parseBlock);
+	FAIL_IF_NOT_T(TOKEN_END);
+	SUCCEED();
+}
+
+// Same as 'for', resolveProgram() checks that the iterations are independent
+bool parseParallelFor(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
+	SAVE();
+	FAIL_IF_NOT_T_NO_POP(TOKEN_PARALLEL);
+	FAIL_IF_NOT_NO_POP(parseFor);
+	parent->children[parent->childCount - 1].syntax = SYNTAX_PARALLEL_FOR;
+	SUCCEED();
+}
+
+// 'bench "name" do ... end', see bench.c
+bool parseBench(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
+	SAVE();
+	PUSH(SYNTAX_BENCH);
+	FAIL_IF_NOT_T(TOKEN_BENCH);
+	FAIL_IF_NOT_T(TOKEN_STRING);
+	FAIL_IF_NOT_T(TOKEN_DO);
+	QUESTION(parseBlock);
+	FAIL_IF_NOT_T(TOKEN_END);
+	SUCCEED();
+}
+
+static bool _parseParensExpression(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	FAIL_IF_NOT_T_NO_POP(TOKEN_L_PAREN);
 	FAIL_IF_NOT_NO_POP(parseExpression);
@@ -333,40 +635,78 @@ static bool _parseParensExpression(const Token** t, const Token* const end, Pars
 // Returns -1 if s is not a binary operator
 static int _precedence(Syntax s) {
 	switch (s) { 
+	case TOKEN_OR:
+		return 0;
+	case TOKEN_AND:
+		return 1;
 	case TOKEN_EQUAL:
 	case TOKEN_NOT_EQUAL:
 	case TOKEN_GREATER:
 	case TOKEN_LESS:
 	case TOKEN_GREATER_EQUAL:
 	case TOKEN_LESS_EQUAL:
-		return 0;
+		return 2;
 	case TOKEN_PLUS:
 	case TOKEN_MINUS:
-		return 1;
+		return 3;
 	case TOKEN_MULTIPLY:
 	case TOKEN_DIVIDE:
-		return 2;
+		return 4;
 	default:
 		return -1;
 	}
 }
 
-bool parseExpression(const Token** t, const Token* const end, ParseNode* parent) {
+// Turns chains like ((a and b) and c) into a single node with operands a, b and c
+static void _flattenLogical(ParseNode* node) {
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		_flattenLogical(&node->children[i]);
+	}
+	if (node->syntax != TOKEN_AND && node->syntax != TOKEN_OR) {
+		return;
+	}
+	size_t count = 0;
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		count += node->children[i].syntax == node->syntax ? node->children[i].childCount : 1;
+	}
+	if (count == node->childCount) {
+		return;
+	}
+	assert(count <= UINT16_MAX);
+	ParseNode* children = memoryAllocate(count * sizeof *children, MEMORY_SYNTAX_TREE);
+	size_t j = 0;
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		ParseNode* child = &node->children[i];
+		if (child->syntax == node->syntax) {
+			memcpy(children + j, child->children, child->childCount * sizeof *children);
+			j += child->childCount;
+			memoryFree(child->children);
+		}
+		else {
+			children[j++] = *child;
+		}
+	}
+	memoryFree(node->children);
+	node->children = children;
+	node->childCount = node->childCapacity = count;
+}
+
+bool parseExpression(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	PUSH(SYNTAX_NONE);
 	FAIL_IF_NOT(parseUnaryExpression);
 	int prevPrecedence = 0;
 	int iteration = 0;
 	while (true) {
-		if (*t == end) {
+		if (t->syntax == end) {
 			break;
 		}
-		Syntax s = (*t)->syntax;
+		Syntax s = *t->syntax;
 		const int precedence = _precedence(s);
 		if (precedence == -1) {
 			break;
 		}
-		++*t;
+		++t->syntax;
 		if (iteration > 0 && precedence <= prevPrecedence) {
 			parseNodeMerge(parent);
 			ParseNode* it = &_savedParent->children[_savedParent->childCount - 1];
@@ -401,18 +741,19 @@ bool parseExpression(const Token** t, const Token* const end, ParseNode* parent)
 		++iteration;
 	}
 	parseNodeMerge(parent);
+	_flattenLogical(&_savedParent->children[_savedParent->childCount - 1]);
 	SUCCEED();
 }
 
-bool parseUnaryExpression(const Token** t, const Token* const end, ParseNode* parent) {
-	if (*t == end) {
+bool parseUnaryExpression(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
+	if (t->syntax == end) {
 		return false;
 	}
 	SAVE();
-	switch ((*t)->syntax) {
+	switch (*t->syntax) {
 	case TOKEN_NOT:
-		PUSH((*t)->syntax);
-		++*t;
+		PUSH(*t->syntax);
+		++t->syntax;
 		break;
 	default:
 		FAIL_IF_NOT_NO_POP(parsePrimaryExpression);
@@ -423,26 +764,37 @@ bool parseUnaryExpression(const Token** t, const Token* const end, ParseNode* pa
 	FAIL();
 }
 
-bool parsePrimaryExpression(const Token** t, const Token* const end, ParseNode* parent) {
+bool parsePrimaryExpression(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
 	SAVE();
 	SUCCEED_IF(parseFunctionCall);
 	SUCCEED_IF(_parseParensExpression);
+	SUCCEED_IF(parseIndex);
 	SUCCEED_IF_T(TOKEN_IDENTIFIER);
 	SUCCEED_IF_T(TOKEN_INTEGER);
 	SUCCEED_IF_T(TOKEN_STRING);
 	FAIL_NO_POP();
 }
 
-bool parseToken(const Token** t, const Token* const end, ParseNode* parent, Syntax targetToken) {
-	if (*t == end) {
+bool parseIndex(TokenCursor* t, const Syntax* const end, ParseNode* parent) {
+	SAVE();
+	PUSH(SYNTAX_INDEX);
+	FAIL_IF_NOT_T(TOKEN_IDENTIFIER);
+	FAIL_IF_NOT_T(TOKEN_L_BRACKET);
+	FAIL_IF_NOT(parseExpression);
+	FAIL_IF_NOT_T(TOKEN_R_BRACKET);
+	SUCCEED();
+}
+
+bool parseToken(TokenCursor* t, const Syntax* const end, ParseNode* parent, Syntax targetToken) {
+	if (t->syntax == end) {
 		return false;
 	}
-	if ((*t)->syntax != targetToken) {
+	if (*t->syntax != targetToken) {
 		return false;
 	}
-	if (targetToken == TOKEN_IDENTIFIER || targetToken == TOKEN_INTEGER || targetToken == TOKEN_STRING) {
-		parseNodePushChild(parent, targetToken)->data = (*t)->data;
+	if (TOKEN_HAS_DATA(targetToken)) {
+		parseNodePushChild(parent, targetToken)->data = *t->data++;
 	}
-	++*t;
+	++t->syntax;
 	return true;
 }
@@ -0,0 +1,243 @@
+#define _POSIX_C_SOURCE 200809L
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// NOTE:	A fixed set of threads that runs batches of independent tasks, see poolRun()
+//			- Task indices are handed out through a shared counter, so uneven tasks balance themselves
+//			- The calling thread works on the batch too, the pool only starts poolThreadCount() - 1 workers
+//			- Workers are started by the first batch and wait on a condition variable between batches
+//			- Tasks must not touch the interpreter state (value stack, collector), they only see 'context'
+#define MAX_THREADS	64
+
+static pthread_t workers[MAX_THREADS];
+static size_t workerCount = 0;
+static size_t threadCount = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+
+// The current batch, only changed while no worker is busy
+static PoolTask batchTask = NULL;
+static void* batchContext = NULL;
+static size_t batchCount = 0;
+static size_t batchNext = 0;
+static uint64_t generation = 0;
+static size_t busy = 0;
+
+static void _work(PoolTask task, void* context, size_t count) {
+	while (true) {
+		const size_t index = __atomic_fetch_add(&batchNext, 1, __ATOMIC_RELAXED);
+		if (index >= count) {
+			return;
+		}
+		task(context, index);
+	}
+}
+
+static void* _worker(void* unused) {
+	(void)unused;
+	uint64_t seen = 0;
+	pthread_mutex_lock(&lock);
+	while (true) {
+		while (generation == seen) {
+			pthread_cond_wait(&wake, &lock);
+		}
+		seen = generation;
+		++busy;
+		const PoolTask task = batchTask;
+		void* const context = batchContext;
+		const size_t count = batchCount;
+		pthread_mutex_unlock(&lock);
+		_work(task, context, count);
+		pthread_mutex_lock(&lock);
+		if (--busy == 0) {
+			pthread_cond_signal(&finished);
+		}
+	}
+	return NULL;
+}
+
+size_t poolThreadCount(void) {
+	if (threadCount == 0) {
+		const long online = sysconf(_SC_NPROCESSORS_ONLN);
+		threadCount = online < 1 ? 1 : online > MAX_THREADS ? MAX_THREADS : (size_t)online;
+	}
+	return threadCount;
+}
+
+// Only the thread that called fork() exists in the child, workers are started again by the next batch
+void poolForked(void) {
+	workerCount = 0;
+	busy = 0;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&wake, NULL);
+	pthread_cond_init(&finished, NULL);
+}
+
+static void _start(void) {
+	const size_t wanted = poolThreadCount() - 1;
+	while (workerCount < wanted) {
+		if (pthread_create(&workers[workerCount], NULL, _worker, NULL) != 0) {
+			// Fewer workers only means less parallelism
+			break;
+		}
+		pthread_detach(workers[workerCount]);
+		++workerCount;
+	}
+}
+
+// Runs task(context, i) for every i below 'count' and returns when all of them have finished
+void poolRun(PoolTask task, void* context, size_t count) {
+	if (count == 0) {
+		return;
+	}
+	if (count == 1 || poolThreadCount() == 1) {
+		for (size_t i = 0; i < count; ++i) {
+			task(context, i);
+		}
+		return;
+	}
+	_start();
+	pthread_mutex_lock(&lock);
+	// A worker that woke up late for the previous batch may still be checking its counter
+	while (busy != 0) {
+		pthread_cond_wait(&finished, &lock);
+	}
+	batchTask = task;
+	batchContext = context;
+	batchCount = count;
+	batchNext = 0;
+	++generation;
+	pthread_cond_broadcast(&wake);
+	pthread_mutex_unlock(&lock);
+	_work(task, context, count);
+	pthread_mutex_lock(&lock);
+	while (busy != 0) {
+		pthread_cond_wait(&finished, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+// NOTE:	poolFor() splits a range evenly between the threads and every thread takes 'grain' iterations at a
+//			time from its own part
+//			- A thread whose part is empty steals the upper half of the largest remaining part, so iterations of
+//			  uneven cost still balance
+//			- Parts are only changed under their lock, the unlocked reads that pick a victim are rechecked
+#define GRAINS_PER_THREAD	64
+
+typedef struct Part	Part;
+struct Part {
+	pthread_mutex_t	lock;
+	int64_t			first;
+	int64_t			last;
+} __attribute__((aligned(64)));	// One cache line each, owners update them all the time
+
+typedef struct Loop	Loop;
+struct Loop {
+	PoolRangeTask	task;
+	void*			context;
+	Part*			parts;
+	size_t			partCount;
+	int64_t			grain;
+};
+
+static int64_t _remaining(Part* part) {
+	return __atomic_load_n(&part->last, __ATOMIC_RELAXED) - __atomic_load_n(&part->first, __ATOMIC_RELAXED);
+}
+
+static void _setPart(Part* part, int64_t first, int64_t last) {
+	__atomic_store_n(&part->first, first, __ATOMIC_RELAXED);
+	__atomic_store_n(&part->last, last, __ATOMIC_RELAXED);
+}
+
+static bool _take(Part* part, int64_t grain, int64_t* first, int64_t* last) {
+	pthread_mutex_lock(&part->lock);
+	const bool found = part->first != part->last;
+	if (found) {
+		*first = part->first;
+		*last = part->last - part->first > grain ? part->first + grain : part->last;
+		_setPart(part, *last, part->last);
+	}
+	pthread_mutex_unlock(&part->lock);
+	return found;
+}
+
+static bool _steal(Loop* loop, size_t thief) {
+	while (true) {
+		Part* victim = NULL;
+		int64_t most = 0;
+		for (size_t i = 0; i < loop->partCount; ++i) {
+			const int64_t remaining = _remaining(&loop->parts[i]);
+			if (i != thief && remaining > most) {
+				victim = &loop->parts[i];
+				most = remaining;
+			}
+		}
+		if (victim == NULL) {
+			return false;
+		}
+		pthread_mutex_lock(&victim->lock);
+		const int64_t remaining = victim->last - victim->first;
+		if (remaining == 0) {
+			pthread_mutex_unlock(&victim->lock);
+			continue;
+		}
+		const int64_t middle = victim->last - (remaining + 1) / 2;
+		const int64_t last = victim->last;
+		_setPart(victim, victim->first, middle);
+		pthread_mutex_unlock(&victim->lock);
+		Part* own = &loop->parts[thief];
+		pthread_mutex_lock(&own->lock);
+		_setPart(own, middle, last);
+		pthread_mutex_unlock(&own->lock);
+		return true;
+	}
+}
+
+static void _runPart(void* context, size_t index) {
+	Loop* loop = context;
+	int64_t first, last;
+	while (true) {
+		if (_take(&loop->parts[index], loop->grain, &first, &last)) {
+			loop->task(loop->context, index, first, last);
+		}
+		else if (!_steal(loop, index)) {
+			return;
+		}
+	}
+}
+
+// Runs task(context, worker, ...) over [first, last), 'worker' is below poolThreadCount() and is only used by
+// one thread at a time
+void poolFor(PoolRangeTask task, void* context, int64_t first, int64_t last) {
+	if (first >= last) {
+		return;
+	}
+	const size_t count = poolThreadCount();
+	Loop loop = {
+		.task = task,
+		.context = context,
+		.partCount = count,
+	};
+	if (posix_memalign((void**)&loop.parts, sizeof *loop.parts, count * sizeof *loop.parts) != 0) {
+		fprintf(stderr, "Error: Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	// Computed in unsigned arithmetic, the length of the range may not fit in an int64_t
+	const uint64_t length = (uint64_t)last - (uint64_t)first;
+	loop.grain = length / (count * GRAINS_PER_THREAD) == 0 ? 1 : length / (count * GRAINS_PER_THREAD);
+	for (size_t i = 0; i < count; ++i) {
+		pthread_mutex_init(&loop.parts[i].lock, NULL);
+		loop.parts[i].first = (int64_t)((uint64_t)first + length / count * i);
+		loop.parts[i].last = i + 1 == count ? last : (int64_t)((uint64_t)first + length / count * (i + 1));
+	}
+	poolRun(_runPart, &loop, count);
+	for (size_t i = 0; i < count; ++i) {
+		pthread_mutex_destroy(&loop.parts[i].lock);
+	}
+	free(loop.parts);
+}
@@ -0,0 +1,948 @@
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <setjmp.h>
+
+#define MAX_REDUCTION_COUNT		8
+#define MAX_IMPORT_COUNT		16
+#define INITIAL_TABLE_CAPACITY	32
+
+// NOTE:	Resolution binds every name in the tree before it is evaluated
+//			- Identifiers become RUNTIME_KNOWN_VARIABLE (index relative to frameStart)
+//			  or RUNTIME_KNOWN_GLOBAL_VARIABLE (absolute index)
+//			- Function calls become RUNTIME_KNOWN_FUNCTION, RUNTIME_GENERATOR_CALL or RUNTIME_NATIVE_FUNCTION
+//			- 'depth' mirrors stackCount - frameStart at the start of each statement
+typedef struct Variable	Variable;
+struct Variable {
+	uint64_t	identifier;
+	ssize_t		index;
+};
+
+typedef struct Function	Function;
+struct Function {
+	uint64_t	identifier;
+	ParseNode*	node;
+	bool		generator;	// Contains 'yield'
+};
+
+static Variable* globalScope = NULL;
+static size_t globalScopeCount = 0;
+static size_t globalScopeCapacity = 0;
+static Variable* scope = NULL;
+static size_t scopeCount = 0;
+static size_t scopeCapacity = 0;
+static Function* functions = NULL;
+static size_t functionCount = 0;
+static size_t functionCapacity = 0;
+static uint32_t* functionIndex = NULL;	// Hash table of 1 + the index of a function, 0 for an empty slot
+static size_t functionIndexCapacity = 0;
+static size_t indexedCount = 0;	// Functions in functionIndex, the first ones of 'functions'
+static ssize_t depth = 0;
+static bool inFunction = false;
+static ParseNode** unresolved = NULL;	// Functions whose body is resolved after the top level
+static size_t unresolvedCount = 0;
+static size_t unresolvedCapacity = 0;
+static ParseNode** parallelFors = NULL;	// Checked once every function has been resolved
+static size_t parallelForCount = 0;
+
+static ParseNode** parallelLoops = NULL;	// Every loop checked so far, resolveReload() checks them again
+static size_t parallelLoopCount = 0;
+static jmp_buf* recovery = NULL;	// Set by resolveReload() and resolveProgramChecked(), errors then return
+static const Module* imports[MAX_IMPORT_COUNT];
+static size_t importCount = 0;
+static ParseNode** reloading = NULL;	// Functions that resolveReload() replaces
+static ParseNode** reloadingContents = NULL;
+static size_t reloadingCount = 0;
+static size_t reloadingCapacity = 0;
+
+static void resolve(ParseNode* node);
+static bool _containsYield(const ParseNode* node);
+
+__attribute__((noreturn)) static void _fail(const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	if (recovery != NULL) {
+		longjmp(*recovery, 1);
+	}
+	exit(EXIT_FAILURE);
+}
+
+// Makes room for one more item in a table that grows by doubling
+static void* _reserve(void* items, size_t count, size_t* capacity, size_t size) {
+	if (count < *capacity) {
+		return items;
+	}
+	*capacity = *capacity == 0 ? INITIAL_TABLE_CAPACITY : *capacity * 2;
+	return memoryReallocate(items, *capacity * size, MEMORY_ANALYSIS);
+}
+
+static void declare(ParseNode* identifier) {
+	scope = _reserve(scope, scopeCount, &scopeCapacity, sizeof *scope);
+	scope[scopeCount].identifier = identifier->data.identifier;
+	scope[scopeCount].index = depth;
+	++scopeCount;
+	identifier->syntax = RUNTIME_KNOWN_VARIABLE;
+	identifier->stackIndex = depth++;
+}
+
+static void lookupVariable(ParseNode* identifier) {
+	for (ssize_t i = scopeCount - 1; i >= 0; --i) {
+		if (scope[i].identifier == identifier->data.identifier) {
+			identifier->syntax = RUNTIME_KNOWN_VARIABLE;
+			identifier->stackIndex = scope[i].index;
+			return;
+		}
+	}
+	for (ssize_t i = globalScopeCount - 1; i >= 0; --i) {
+		if (globalScope[i].identifier == identifier->data.identifier) {
+			identifier->syntax = RUNTIME_KNOWN_GLOBAL_VARIABLE;
+			identifier->stackIndex = globalScope[i].index;
+			return;
+		}
+	}
+	_fail("Error: Variable not in scope\n");
+}
+
+static void _addFunction(ParseNode* node) {
+	functions = _reserve(functions, functionCount, &functionCapacity, sizeof *functions);
+	functions[functionCount].identifier = node->children[0].data.identifier;
+	functions[functionCount].node = node;
+	functions[functionCount].generator = _containsYield(&node->children[2]);
+	++functionCount;
+}
+
+static void _addUnresolved(ParseNode* node) {
+	unresolved = _reserve(unresolved, unresolvedCount, &unresolvedCapacity, sizeof *unresolved);
+	unresolved[unresolvedCount++] = node;
+}
+
+// Slot of 'identifier' in functionIndex, or of the empty slot where it would go
+static uint32_t* _indexSlot(uint64_t identifier) {
+	size_t i = hashMix(identifier) & (functionIndexCapacity - 1);
+	while (functionIndex[i] != 0 && functions[functionIndex[i] - 1].identifier != identifier) {
+		i = (i + 1) & (functionIndexCapacity - 1);
+	}
+	return &functionIndex[i];
+}
+
+// Functions from 'count' on are forgotten
+static void _dropFunctions(size_t count) {
+	functionCount = count;
+	if (indexedCount > count) {
+		memset(functionIndex, 0, functionIndexCapacity * sizeof *functionIndex);
+		indexedCount = 0;
+	}
+}
+
+// The index is brought up to date with 'functions' lazily
+static Function* _findFunction(uint64_t identifier) {
+	if (functionCount * 2 > functionIndexCapacity) {
+		while (functionCount * 2 > functionIndexCapacity) {
+			functionIndexCapacity = functionIndexCapacity == 0 ? INITIAL_TABLE_CAPACITY : functionIndexCapacity * 2;
+		}
+		memoryFree(functionIndex);
+		functionIndex = memoryAllocateZeroed(functionIndexCapacity * sizeof *functionIndex, MEMORY_ANALYSIS);
+		indexedCount = 0;
+	}
+	for (; indexedCount < functionCount; ++indexedCount) {
+		uint32_t* slot = _indexSlot(functions[indexedCount].identifier);
+		// The first function with a name is the one that is called
+		if (*slot == 0) {
+			*slot = indexedCount + 1;
+		}
+	}
+	if (functionIndexCapacity == 0) {
+		return NULL;
+	}
+	const uint32_t index = *_indexSlot(identifier);
+	return index == 0 ? NULL : &functions[index - 1];
+}
+
+// 'module.name(...)' is bound to a function of a module, which was resolved when it was loaded
+static void lookupModuleFunction(ParseNode* functionCall) {
+	const uint64_t name = functionCall->children[2].data.identifier;
+	const Module* module = NULL;
+	for (size_t i = 0; i < importCount; ++i) {
+		if (imports[i]->name == name) {
+			module = imports[i];
+		}
+	}
+	if (module == NULL) {
+		_fail("Error: Module not imported\n");
+	}
+	const uint64_t identifier = functionCall->children[0].data.identifier;
+	for (uint32_t i = 0; i < module->root->childCount; ++i) {
+		ParseNode* function = &module->root->children[i];
+		if (function->syntax == SYNTAX_FUNCTION && function->children[0].data.identifier == identifier) {
+			functionCall->syntax = _containsYield(&function->children[2]) ? RUNTIME_GENERATOR_CALL
+				: RUNTIME_KNOWN_FUNCTION;
+			functionCall->function = function;
+			return;
+		}
+	}
+	_fail("Error: Function not found in module '%s'\n", module->path);
+}
+
+static void lookupFunction(ParseNode* functionCall) {
+	if (functionCall->childCount == 3) {
+		lookupModuleFunction(functionCall);
+		return;
+	}
+	const uint64_t identifier = functionCall->children[0].data.identifier;
+	Function* function = _findFunction(identifier);
+	// Functions of the script shadow natives, so new standard functions do not change existing scripts
+	const Native* native = function == NULL ? nativeFind(identifier) : NULL;
+	if (native != NULL) {
+		const uint32_t argCount = functionCall->children[1].childCount;
+		if (native->arity != NATIVE_ANY_ARITY && native->arity != (int32_t)argCount) {
+			_fail("Error: Expected %hd argument(s) but got %u\n", native->arity, argCount);
+		}
+		functionCall->syntax = RUNTIME_NATIVE_FUNCTION;
+		functionCall->native = native;
+		return;
+	}
+	if (function == NULL) {
+		_fail("Error: Function not found\n");
+	}
+	ParseNode* body = &function->node->children[2];
+	if (body->syntax == SYNTAX_LAZY_BLOCK) {
+		// First call of a function skipped by parseProgram()
+		parseLazyBlock(body);
+		function->generator = _containsYield(body);
+		_addUnresolved(function->node);
+	}
+	functionCall->syntax = function->generator ? RUNTIME_GENERATOR_CALL : RUNTIME_KNOWN_FUNCTION;
+	functionCall->function = function->node;
+}
+
+static bool _isVariable(const ParseNode* node) {
+	return node->syntax == RUNTIME_KNOWN_VARIABLE || node->syntax == RUNTIME_KNOWN_GLOBAL_VARIABLE;
+}
+
+static bool _sameVariable(const ParseNode* a, const ParseNode* b) {
+	return _isVariable(a) && a->syntax == b->syntax && a->stackIndex == b->stackIndex;
+}
+
+static bool _assigns(const ParseNode* node, const ParseNode* variable) {
+	if (node->syntax == SYNTAX_ASSIGNMENT && _sameVariable(&node->children[0], variable)) {
+		return true;
+	}
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		if (_assigns(&node->children[i], variable)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool _containsYield(const ParseNode* node) {
+	if (node->syntax == SYNTAX_YIELD) {
+		return true;
+	}
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		if (_containsYield(&node->children[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Whether other script code can run in the middle of 'node', which could then assign globals
+static bool _callsFunction(const ParseNode* node) {
+	switch (node->syntax) {
+	case RUNTIME_KNOWN_FUNCTION:
+	case SYNTAX_YIELD:
+		return true;
+	case RUNTIME_NATIVE_FUNCTION:
+		if (node->native->flags & NATIVE_RUNS_SCRIPT) {
+			return true;
+		}
+		break;
+	}
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		if (_callsFunction(&node->children[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Whether 'expression' has the same value on every iteration of a loop over 'body'
+static bool _isInvariant(const ParseNode* expression, const ParseNode* body, bool bodyCalls) {
+	switch (expression->syntax) {
+	case TOKEN_INTEGER:
+		return true;
+	case RUNTIME_KNOWN_GLOBAL_VARIABLE:
+		if (bodyCalls) {
+			return false;
+		}
+		__attribute__((fallthrough));
+	case RUNTIME_KNOWN_VARIABLE:
+		return !_assigns(body, expression);
+	case TOKEN_PLUS:
+	case TOKEN_MINUS:
+	case TOKEN_MULTIPLY:
+	case TOKEN_DIVIDE:
+		return _isInvariant(&expression->children[0], body, bodyCalls)
+			&& _isInvariant(&expression->children[1], body, bodyCalls);
+	case RUNTIME_NATIVE_FUNCTION:
+		if (!(expression->native->flags & NATIVE_PURE)) {
+			return false;
+		}
+		for (uint32_t i = 0; i < expression->children[1].childCount; ++i) {
+			if (!_isInvariant(&expression->children[1].children[i], body, bodyCalls)) {
+				return false;
+			}
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Recognizes 'while i < n do ... i = i + c end' where only the final statement changes i and n is invariant
+static void analyzeCountedLoop(ParseNode* node) {
+	const ParseNode* condition = &node->children[0];
+	const ParseNode* body = &node->children[1];
+	switch (condition->syntax) {
+	case TOKEN_LESS:
+	case TOKEN_LESS_EQUAL:
+	case TOKEN_GREATER:
+	case TOKEN_GREATER_EQUAL:
+	case TOKEN_NOT_EQUAL:
+		break;
+	default:
+		return;
+	}
+	const ParseNode* counter = &condition->children[0];
+	if (!_isVariable(counter) || body->childCount == 0) {
+		return;
+	}
+	const ParseNode* increment = &body->children[body->childCount - 1];
+	if (increment->syntax != SYNTAX_ASSIGNMENT || !_sameVariable(&increment->children[0], counter)) {
+		return;
+	}
+	const ParseNode* sum = &increment->children[1];
+	if ((sum->syntax != TOKEN_PLUS && sum->syntax != TOKEN_MINUS) || sum->children[1].syntax != TOKEN_INTEGER
+		|| !_sameVariable(&sum->children[0], counter)) {
+		return;
+	}
+	for (uint32_t i = 0; i + 1 < body->childCount; ++i) {
+		if (_assigns(&body->children[i], counter)) {
+			return;
+		}
+	}
+	const bool bodyCalls = _callsFunction(body);
+	if ((bodyCalls && counter->syntax == RUNTIME_KNOWN_GLOBAL_VARIABLE)
+		|| !_isInvariant(&condition->children[1], body, bodyCalls)) {
+		return;
+	}
+	const int64_t step = sum->children[1].data.integerLiteral;
+	node->syntax = RUNTIME_COUNTED_WHILE;
+	node->data.integerLiteral = sum->syntax == TOKEN_PLUS ? step : -step;
+}
+
+// NOTE:	Iterations of 'parallel for' run concurrently, each worker on its own copy of the value stack
+//			- Variables from outside the loop are read-only, except for sums 'x = x + e' where e does not read x
+//			- Every worker sums into its own copy of x starting at 0, and the copies are added to x after the
+//			  loop, so x cannot be read anywhere else in the body
+//			- The body cannot return, yield or resume generators, and the functions that it calls cannot
+//			  assign globals
+//			- Maps are not thread safe, so the only maps that can be modified (m[k] = v, map_set(), map_delete())
+//			  are locals of the body or of a called function that are only ever assigned a new map(), a map that
+//			  was read from elsewhere or passed as an argument may be shared with other iterations
+//			- Natives that use state of the process, such as the buffers of read_line() and write(), cannot be called
+typedef struct ParallelCheck	ParallelCheck;
+struct ParallelCheck {
+	ssize_t				loopIndex;	// Locals below it were declared outside the loop
+	const ParseNode*	region;		// The body, or the body of the function being checked
+	ssize_t				firstLocal;	// Of the region, parameters and outer variables are below it
+	const ParseNode*	reductions[MAX_REDUCTION_COUNT];
+	size_t				reductionCount;
+	const ParseNode**	checked;	// Functions checked so far
+	size_t				checkedCount;
+	size_t				checkedCapacity;
+};
+
+static void _parallelError(const char* message) {
+	_fail("Error: %s in 'parallel for'\n", message);
+}
+
+static bool _isOuter(const ParallelCheck* check, const ParseNode* variable) {
+	return variable->syntax == RUNTIME_KNOWN_GLOBAL_VARIABLE
+		|| (variable->syntax == RUNTIME_KNOWN_VARIABLE && variable->stackIndex < check->loopIndex);
+}
+
+static bool _reads(const ParseNode* node, const ParseNode* variable) {
+	if (_sameVariable(node, variable)) {
+		return true;
+	}
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		if (_reads(&node->children[i], variable)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool _isReduction(const ParallelCheck* check, const ParseNode* variable) {
+	for (size_t i = 0; i < check->reductionCount; ++i) {
+		if (_sameVariable(check->reductions[i], variable)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool _isNewMap(const ParseNode* node) {
+	static const Native* map = NULL;
+	if (map == NULL) {
+		map = nativeFind(hash((const uint8_t*)"map", 3));
+	}
+	return node->syntax == RUNTIME_NATIVE_FUNCTION && node->native == map;
+}
+
+// Whether every declaration and assignment of 'variable' in 'node' gives it a new map (or nothing)
+static bool _onlyNewMaps(const ParseNode* node, const ParseNode* variable) {
+	if ((node->syntax == SYNTAX_DECLARATION || node->syntax == SYNTAX_ASSIGNMENT)
+		&& _sameVariable(&node->children[0], variable) && node->childCount == 2 && !_isNewMap(&node->children[1])) {
+		return false;
+	}
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		if (!_onlyNewMaps(&node->children[i], variable)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void _checkWrite(const ParallelCheck* check, const ParseNode* map) {
+	if (map->syntax == RUNTIME_KNOWN_GLOBAL_VARIABLE
+		|| (map->syntax == RUNTIME_KNOWN_VARIABLE && map->stackIndex < check->firstLocal)) {
+		_parallelError("Outer maps and arguments cannot be modified");
+	}
+	if (map->syntax != RUNTIME_KNOWN_VARIABLE || !_onlyNewMaps(check->region, map)) {
+		_parallelError("Only maps created by the iteration can be modified");
+	}
+}
+
+static void _checkCallee(ParallelCheck* check, const ParseNode* node);
+
+// Things that are not allowed anywhere in a parallel iteration, including called functions
+static void _checkCall(ParallelCheck* check, const ParseNode* node) {
+	switch (node->syntax) {
+	case RUNTIME_GENERATOR_CALL:
+		_parallelError("Generators cannot be used");
+		break;
+	case SYNTAX_INDEX_ASSIGNMENT:
+		_checkWrite(check, &node->children[0]);
+		break;
+	case RUNTIME_NATIVE_FUNCTION:
+		if (node->native->flags & NATIVE_RUNS_SCRIPT) {
+			_parallelError("Generators cannot be resumed");
+		}
+		if (node->native->flags & NATIVE_SERIAL) {
+			_parallelError("Natives that are not thread safe cannot be called");
+		}
+		if (node->native->flags & NATIVE_MUTATES) {
+			_checkWrite(check, &node->children[1].children[0]);
+		}
+		break;
+	case RUNTIME_KNOWN_FUNCTION:
+		_checkCallee(check, node->function);
+		break;
+	}
+}
+
+// The contents that a function node will have once resolveReload() is done
+static const ParseNode* _reloaded(const ParseNode* function) {
+	for (size_t i = 0; i < reloadingCount; ++i) {
+		if (reloading[i] == function) {
+			return reloadingContents[i];
+		}
+	}
+	return function;
+}
+
+static void _checkCallee(ParallelCheck* check, const ParseNode* node) {
+	if (node->syntax == SYNTAX_FUNCTION) {
+		for (size_t i = 0; i < check->checkedCount; ++i) {
+			if (check->checked[i] == node) {
+				return;
+			}
+		}
+		check->checked = _reserve(check->checked, check->checkedCount, &check->checkedCapacity, sizeof *check->checked);
+		check->checked[check->checkedCount++] = node;
+		const ParseNode* savedRegion = check->region;
+		const ssize_t savedFirstLocal = check->firstLocal;
+		check->region = &_reloaded(node)->children[2];
+		check->firstLocal = 0;
+		_checkCallee(check, check->region);
+		check->region = savedRegion;
+		check->firstLocal = savedFirstLocal;
+		return;
+	}
+	if (node->syntax == SYNTAX_ASSIGNMENT && node->children[0].syntax == RUNTIME_KNOWN_GLOBAL_VARIABLE) {
+		_parallelError("Functions called cannot assign globals");
+	}
+	if (node->syntax == RUNTIME_KNOWN_GLOBAL_VARIABLE && _isReduction(check, node)) {
+		_parallelError("Reduction variables cannot be read");
+	}
+	_checkCall(check, node);
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		_checkCallee(check, &node->children[i]);
+	}
+}
+
+static void _findReductions(ParallelCheck* check, const ParseNode* node) {
+	if (node->syntax == SYNTAX_ASSIGNMENT && _isOuter(check, &node->children[0])) {
+		const ParseNode* variable = &node->children[0];
+		const ParseNode* sum = &node->children[1];
+		if (sum->syntax != TOKEN_PLUS || sum->childCount != 2 || !_sameVariable(&sum->children[0], variable)
+			|| _reads(&sum->children[1], variable)) {
+			_parallelError("Outer variables can only be summed into");
+		}
+		if (!_isReduction(check, variable)) {
+			if (check->reductionCount == MAX_REDUCTION_COUNT) {
+				_parallelError("Too many reductions");
+			}
+			check->reductions[check->reductionCount++] = variable;
+		}
+		return;
+	}
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		_findReductions(check, &node->children[i]);
+	}
+}
+
+static void _checkBody(ParallelCheck* check, const ParseNode* node) {
+	switch (node->syntax) {
+	case RUNTIME_REDUCTIONS:
+		// Of a nested loop that was checked already
+		return;
+	case SYNTAX_RETURN:
+	case SYNTAX_YIELD:
+		_parallelError("'return' and 'yield' cannot be used");
+		break;
+	case SYNTAX_ASSIGNMENT:
+		if (_isReduction(check, &node->children[0])) {
+			// Only the added expression is evaluated normally
+			_checkBody(check, &node->children[1].children[1]);
+			return;
+		}
+		break;
+	case RUNTIME_KNOWN_VARIABLE:
+	case RUNTIME_KNOWN_GLOBAL_VARIABLE:
+		if (_isReduction(check, node)) {
+			_parallelError("Reduction variables cannot be read");
+		}
+		break;
+	}
+	_checkCall(check, node);
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		_checkBody(check, &node->children[i]);
+	}
+}
+
+static ParallelCheck _checkParallelFor(const ParseNode* node) {
+	const ParseNode* body = &node->children[3];
+	ParallelCheck check = {
+		.loopIndex = node->children[0].stackIndex,
+		.region = body,
+		.firstLocal = node->children[0].stackIndex,
+	};
+	_findReductions(&check, body);
+	_checkBody(&check, body);
+	memoryFree(check.checked);
+	check.checked = NULL;
+	return check;
+}
+
+// Appends the RUNTIME_REDUCTIONS child that eval() uses to combine the copies of the workers
+static void analyzeParallelFor(ParseNode* node) {
+	const ParallelCheck check = _checkParallelFor(node);
+	parallelLoops = memoryReallocate(parallelLoops, (parallelLoopCount + 1) * sizeof *parallelLoops, MEMORY_ANALYSIS);
+	parallelLoops[parallelLoopCount++] = node;
+	ParseNode reductions = {
+		.syntax = RUNTIME_REDUCTIONS,
+		.childCount = check.reductionCount,
+		.childCapacity = check.reductionCount,
+		.children = memoryAllocateZeroed((check.reductionCount + 1) * sizeof *reductions.children, MEMORY_SYNTAX_TREE),
+	};
+	for (size_t i = 0; i < check.reductionCount; ++i) {
+		reductions.children[i].syntax = check.reductions[i]->syntax;
+		reductions.children[i].stackIndex = check.reductions[i]->stackIndex;
+	}
+	node->children = memoryReallocate(node->children, (node->childCount + 1) * sizeof *node->children,
+		MEMORY_SYNTAX_TREE);
+	node->children[node->childCount++] = reductions;
+	node->childCapacity = node->childCount;
+}
+
+static void resolveChildren(ParseNode* node) {
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		resolve(&node->children[i]);
+	}
+}
+
+static void resolveBlock(ParseNode* node) {
+	const size_t savedScopeCount = scopeCount;
+	const ssize_t savedDepth = depth;
+	resolveChildren(node);
+	scopeCount = savedScopeCount;
+	depth = savedDepth;
+}
+
+static void resolve(ParseNode* node) {
+	switch (node->syntax) {
+	case SYNTAX_BLOCK:
+		resolveBlock(node);
+		return;
+	case SYNTAX_DECLARATION:
+		if (node->childCount == 2) {
+			resolve(&node->children[1]);
+		}
+		declare(&node->children[0]);
+		return;
+	case TOKEN_IDENTIFIER:
+		lookupVariable(node);
+		return;
+	case SYNTAX_FUNCTION_CALL:
+		// Natives and generators take the arguments as a uint16_t count
+		if (node->children[1].childCount > UINT16_MAX) {
+			_fail("Error: Too many arguments\n");
+		}
+		lookupFunction(node);
+		resolve(&node->children[1]);
+		return;
+	case SYNTAX_YIELD:
+		if (!inFunction) {
+			_fail("Error: 'yield' outside of a function\n");
+		}
+		resolveChildren(node);
+		return;
+	case SYNTAX_WHILE:
+		resolveChildren(node);
+		analyzeCountedLoop(node);
+		return;
+	case SYNTAX_FOR:
+	case SYNTAX_PARALLEL_FOR: {
+		// The bounds are evaluated before the loop variable exists
+		resolve(&node->children[1]);
+		resolve(&node->children[2]);
+		const size_t savedScopeCount = scopeCount;
+		const ssize_t savedDepth = depth;
+		declare(&node->children[0]);
+		resolve(&node->children[3]);
+		scopeCount = savedScopeCount;
+		depth = savedDepth;
+		if (node->syntax == SYNTAX_PARALLEL_FOR) {
+			parallelFors = memoryReallocate(parallelFors, (parallelForCount + 1) * sizeof *parallelFors,
+				MEMORY_ANALYSIS);
+			parallelFors[parallelForCount++] = node;
+		}
+		return;
+	}
+	default:
+		resolveChildren(node);
+		return;
+	}
+}
+
+static void resolveFunction(ParseNode* function) {
+	const ParseNode* paramList = &function->children[1];
+	assert(scopeCount == 0);
+	for (uint32_t i = 0; i < paramList->childCount; ++i) {
+		scope = _reserve(scope, scopeCount, &scopeCapacity, sizeof *scope);
+		scope[scopeCount].identifier = paramList->children[i].data.identifier;
+		scope[scopeCount].index = -(ssize_t)(i + 1);
+		++scopeCount;
+	}
+	depth = 0;
+	inFunction = true;
+	resolve(&function->children[2]);
+	inFunction = false;
+	scopeCount = 0;
+}
+
+// Resolving a body may parse more lazy bodies
+static void _resolvePending(void) {
+	for (size_t i = 0; i < unresolvedCount; ++i) {
+		resolveFunction(unresolved[i]);
+	}
+	unresolvedCount = 0;
+	for (size_t i = 0; i < parallelForCount; ++i) {
+		analyzeParallelFor(parallelFors[i]);
+	}
+	memoryFree(parallelFors);
+	parallelFors = NULL;
+	parallelForCount = 0;
+}
+
+// NOTE:	Global declarations are hoisted by evalProgram(), global i lives at stack[i]
+//			Top level statements run with frameStart = 0, so their locals start after the globals
+//			The globals, functions and imports of previous programs stay in the tables, so that a line of the REPL
+//			can use those of the lines before it, resolveReset() drops them (see the daemon in server.c)
+//			Imported modules are resolved before the program adds anything, with tables of their own
+void resolveProgram(ParseNode* root) {
+	for (uint32_t i = 0; i < root->childCount; ++i) {
+		if (root->children[i].syntax != SYNTAX_IMPORT) {
+			continue;
+		}
+		const char* path = root->children[i].children[0].data.stringLiteral;
+		const Module* module = moduleImport(path);
+		if (module == NULL) {
+			_fail("Error: Failed to import '%s'\n", path);
+		}
+		bool known = false;
+		for (size_t j = 0; j < importCount; ++j) {
+			if (imports[j]->name == module->name && imports[j] != module) {
+				_fail("Error: Two modules are imported with the name of '%s'\n", path);
+			}
+			known = known || imports[j] == module;
+		}
+		if (!known) {
+			if (importCount == MAX_IMPORT_COUNT) {
+				_fail("Error: Too many imports\n");
+			}
+			imports[importCount++] = module;
+		}
+	}
+	for (uint32_t i = 0; i < root->childCount; ++i) {
+		ParseNode* node = &root->children[i];
+		if (node->syntax == SYNTAX_FUNCTION) {
+			// TODO: For functions we can check whether arguments have duplicate names e.g. fn add(a, a)
+			// 		Or just do it when parsing
+			_addFunction(node);
+			if (node->children[2].syntax != SYNTAX_LAZY_BLOCK) {
+				_addUnresolved(node);
+			}
+		}
+	}
+	for (uint32_t i = 0; i < root->childCount; ++i) {
+		ParseNode* node = &root->children[i];
+		if (node->syntax == SYNTAX_DECLARATION) {
+			if (node->childCount == 2) {
+				depth = globalScopeCount;
+				resolve(&node->children[1]);
+			}
+			globalScope = _reserve(globalScope, globalScopeCount, &globalScopeCapacity, sizeof *globalScope);
+			globalScope[globalScopeCount].identifier = node->children[0].data.identifier;
+			globalScope[globalScopeCount].index = globalScopeCount;
+			node->children[0].syntax = RUNTIME_KNOWN_GLOBAL_VARIABLE;
+			node->children[0].stackIndex = globalScopeCount;
+			++globalScopeCount;
+		}
+	}
+	for (uint32_t i = 0; i < root->childCount; ++i) {
+		ParseNode* node = &root->children[i];
+		if (node->syntax != SYNTAX_FUNCTION && node->syntax != SYNTAX_DECLARATION) {
+			depth = globalScopeCount;
+			resolve(node);
+		}
+	}
+	_resolvePending();
+}
+
+// Forgets the globals, functions, imports and loops of previous programs, their trees may be freed after that
+void resolveReset(void) {
+	globalScopeCount = 0;
+	_dropFunctions(0);
+	importCount = 0;
+	parallelLoopCount = 0;
+}
+
+// Resolves the root of a module as a program of its own, the tables of the importer are put back afterwards
+void resolveModule(ParseNode* root) {
+	Variable* const savedGlobalScope = globalScope;
+	const size_t savedGlobalScopeCount = globalScopeCount;
+	const size_t savedGlobalScopeCapacity = globalScopeCapacity;
+	Function* const savedFunctions = functions;
+	const size_t savedFunctionCount = functionCount;
+	const size_t savedFunctionCapacity = functionCapacity;
+	uint32_t* const savedFunctionIndex = functionIndex;
+	const size_t savedFunctionIndexCapacity = functionIndexCapacity;
+	const size_t savedIndexedCount = indexedCount;
+	const Module* savedImports[MAX_IMPORT_COUNT];
+	memcpy(savedImports, imports, importCount * sizeof *imports);
+	const size_t savedImportCount = importCount;
+	jmp_buf* const outer = recovery;
+	jmp_buf failed;
+	volatile bool succeeded = false;
+	if (setjmp(failed) == 0) {
+		recovery = &failed;
+		globalScope = NULL;
+		globalScopeCount = globalScopeCapacity = 0;
+		functions = NULL;
+		functionCount = functionCapacity = 0;
+		functionIndex = NULL;
+		functionIndexCapacity = indexedCount = 0;
+		importCount = 0;
+		resolveProgram(root);
+		succeeded = true;
+	}
+	memoryFree(globalScope);
+	memoryFree(functions);
+	memoryFree(functionIndex);
+	globalScope = savedGlobalScope;
+	globalScopeCount = savedGlobalScopeCount;
+	globalScopeCapacity = savedGlobalScopeCapacity;
+	functions = savedFunctions;
+	functionCount = savedFunctionCount;
+	functionCapacity = savedFunctionCapacity;
+	functionIndex = savedFunctionIndex;
+	functionIndexCapacity = savedFunctionIndexCapacity;
+	indexedCount = savedIndexedCount;
+	memcpy(imports, savedImports, savedImportCount * sizeof *imports);
+	importCount = savedImportCount;
+	recovery = outer;
+	if (!succeeded) {
+		// The error was reported already
+		if (recovery == NULL) {
+			exit(EXIT_FAILURE);
+		}
+		longjmp(*recovery, 1);
+	}
+}
+
+// Reports an error and returns false instead of ending the process, the tree must then be thrown away
+bool resolveProgramChecked(ParseNode* root) {
+	jmp_buf failed;
+	if (setjmp(failed) != 0) {
+		recovery = NULL;
+		scopeCount = 0;
+		inFunction = false;
+		unresolvedCount = 0;
+		importCount = 0;
+		memoryFree(parallelFors);
+		parallelFors = NULL;
+		parallelForCount = 0;
+		moduleAbandon();
+		return false;
+	}
+	recovery = &failed;
+	resolveProgram(root);
+	recovery = NULL;
+	return true;
+}
+
+// Loops of a function that is replaced are not run anymore
+static void _forgetLoops(const ParseNode* node) {
+	for (size_t i = 0; i < parallelLoopCount; ++i) {
+		if (parallelLoops[i] == node) {
+			parallelLoops[i] = parallelLoops[--parallelLoopCount];
+			break;
+		}
+	}
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		_forgetLoops(&node->children[i]);
+	}
+}
+
+static bool _isAmong(const ParseNode* node, ParseNode* const* nodes, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		if (nodes[i] == node) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool _contains(const ParseNode* node, const ParseNode* descendant) {
+	if (node == descendant) {
+		return true;
+	}
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		if (_contains(&node->children[i], descendant)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Whether a node belongs to a body that resolveReload() replaces
+static bool _inReloaded(const ParseNode* node) {
+	for (size_t i = 0; i < reloadingCount; ++i) {
+		if (_contains(reloading[i], node)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// NOTE:	Hot reloading (see watch.c) replaces functions of a running program
+//			- The new bodies are resolved and every 'parallel for' is checked again with them before anything is
+//			  replaced, an error leaves the program as it was
+//			- A replaced function is copied over its old node, so that the call sites bound to it run the new body,
+//			  and the old contents are left in *changed[i] for the frames that may still run them
+//			- Call sites are not resolved again, so the parameter count and whether the function is a generator
+//			  cannot change
+//			- Functions that did not exist are added, their nodes must keep their address
+// Returns false if the reload was rejected
+bool resolveReload(ParseNode* const* changed, size_t count) {
+	const size_t savedFunctionCount = functionCount;
+	const size_t savedLoopCount = parallelLoopCount;
+	jmp_buf failed;
+	if (setjmp(failed) != 0) {
+		recovery = NULL;
+		reloadingCount = 0;
+		scopeCount = 0;
+		inFunction = false;
+		_dropFunctions(savedFunctionCount);
+		parallelLoopCount = savedLoopCount;
+		memoryFree(parallelFors);
+		parallelFors = NULL;
+		parallelForCount = 0;
+		// Lazy bodies parsed meanwhile belong to the program, their errors are not part of the reload
+		for (size_t i = 0; i < unresolvedCount; ++i) {
+			if (!_isAmong(unresolved[i], changed, count)) {
+				resolveFunction(unresolved[i]);
+			}
+		}
+		unresolvedCount = 0;
+		return false;
+	}
+	recovery = &failed;
+	for (size_t i = 0; i < count; ++i) {
+		ParseNode* node = changed[i];
+		Function* function = _findFunction(node->children[0].data.identifier);
+		if (function == NULL) {
+			_addFunction(node);
+		}
+		else {
+			if (function->node->children[1].childCount != node->children[1].childCount
+				|| function->generator != _containsYield(&node->children[2])) {
+				_fail("Error: Changing the parameters of a function or whether it yields needs a restart\n");
+			}
+			size_t capacity = reloadingCapacity;
+			reloading = _reserve(reloading, reloadingCount, &capacity, sizeof *reloading);
+			reloadingContents = _reserve(reloadingContents, reloadingCount, &reloadingCapacity,
+				sizeof *reloadingContents);
+			reloading[reloadingCount] = function->node;
+			reloadingContents[reloadingCount] = node;
+			++reloadingCount;
+		}
+		_addUnresolved(node);
+	}
+	_resolvePending();
+	for (size_t i = 0; i < savedLoopCount; ++i) {
+		if (!_inReloaded(parallelLoops[i])) {
+			_checkParallelFor(parallelLoops[i]);
+		}
+	}
+	recovery = NULL;
+	for (size_t i = 0; i < reloadingCount; ++i) {
+		_forgetLoops(&reloading[i]->children[2]);
+		const ParseNode previous = *reloading[i];
+		*reloading[i] = *reloadingContents[i];
+		*reloadingContents[i] = previous;
+	}
+	reloadingCount = 0;
+	return true;
+}
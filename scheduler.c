@@ -0,0 +1,106 @@
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// NOTE:	Green threads: spawn() queues a generator as a task, run() resumes the tasks in turn on the calling thread
+//			- Loop iterations and calls burn one unit of fuel each (see eval.c), a task is preempted when its
+//			  quantum is used up, or gives up the rest of it by yielding
+//			- A task that is running a generator of its own is only preempted once that generator returns to it,
+//			  meanwhile fuel is handed out one unit at a time
+//			- The fuel limit (--fuel) counts the units of the whole script, tasks or not, and ends it with an error
+//			- Iterations of a 'parallel for' other than the first are not metered
+#define QUANTUM	10000
+
+static Coroutine** tasks = NULL;
+static size_t taskCount = 0;
+static size_t taskCapacity = 0;
+static Coroutine* running = NULL;	// Task resumed by schedulerRun()
+static int64_t limit = 0;			// 0 for no limit
+static int64_t burnt = 0;			// Units of the allotments before the current one
+static int64_t allotment = INT64_MAX;	// Units that eval.c had at the start of the current allotment
+
+static void _allot(int64_t units) {
+	if (limit != 0 && limit - burnt < units) {
+		units = limit - burnt;
+	}
+	allotment = units;
+	evalSetFuel(units);
+}
+
+// Adds what was used of the current allotment to 'burnt'
+static void _settle(void) {
+	burnt += allotment - evalFuel();
+	allotment = evalFuel();
+}
+
+void schedulerSetFuelLimit(int64_t units) {
+	limit = units;
+	_allot(units);
+}
+
+void schedulerOutOfFuel(void) {
+	_settle();
+	if (limit != 0 && burnt >= limit) {
+		fflush(stdout);
+		fprintf(stderr, "Error: Fuel limit of %li units exceeded\n", limit);
+		exit(EXIT_FAILURE);
+	}
+	if (running == NULL) {
+		_allot(INT64_MAX);
+	}
+	else if (coroutineCurrent() != running) {
+		_allot(1);
+	}
+	else {
+		// schedulerRun() allots the next quantum when the task is resumed
+		const Data none = { .type = TYPE_VOID };
+		coroutineYield(none);
+	}
+}
+
+void schedulerSpawn(Coroutine* task) {
+	if (taskCount == taskCapacity) {
+		taskCapacity = taskCapacity == 0 ? 16 : taskCapacity * 2;
+		tasks = memoryReallocate(tasks, taskCapacity * sizeof *tasks, MEMORY_HEAP);
+	}
+	tasks[taskCount++] = task;
+}
+
+// Returns when every task has finished, tasks may spawn more
+void schedulerRun(void) {
+	if (coroutineCurrent() != NULL) {
+		fprintf(stderr, "Error: run() can only be called by the main program\n");
+		exit(EXIT_FAILURE);
+	}
+	size_t next = 0;
+	while (taskCount != 0) {
+		if (next >= taskCount) {
+			next = 0;
+		}
+		Coroutine* task = tasks[next];
+		_settle();
+		_allot(QUANTUM);
+		running = task;
+		coroutineResume(task);
+		running = NULL;
+		_settle();
+		if (coroutineDone(task)) {
+			memmove(&tasks[next], &tasks[next + 1], (taskCount - next - 1) * sizeof *tasks);
+			--taskCount;
+		}
+		else {
+			++next;
+		}
+	}
+	_allot(INT64_MAX);
+}
+
+// Queued tasks are reachable from nowhere else, the queue is scanned with the value stack
+void schedulerMarkRoots(void) {
+	for (size_t i = 0; i < taskCount; ++i) {
+		const Data task = { .type = TYPE_COROUTINE, .coroutine = tasks[i] };
+		gcShade(task);
+	}
+}
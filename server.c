@@ -0,0 +1,535 @@
+#define _DEFAULT_SOURCE
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+// NOTE:	Fork server mode (--fork-server) loads a script and runs its global initializers once, then forks a
+//			copy-on-write child for every request on a Unix socket
+//			- A request is one byte with the client's stdin, stdout and stderr attached (SCM_RIGHTS), see
+//			  serverConnect()
+//			- The child takes over those descriptors and runs the top level statements
+//			- When the child exits, its status is sent back as one byte, 128 + the signal if it was killed
+//			- The pool threads do not survive fork(), the child starts its own when it needs them
+#define FD_COUNT	3
+
+typedef struct Request	Request;
+struct Request {
+	pid_t	child;
+	int		connection;
+};
+
+static Request* requests = NULL;
+static size_t requestCount = 0;
+static size_t requestCapacity = 0;
+
+// Only there to interrupt poll()
+static void _onChild(int signal) {
+	(void)signal;
+}
+
+static int _listen(const char* path) {
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof address.sun_path) {
+		fprintf(stderr, "Error: Socket path '%s' is too long\n", path);
+		exit(EXIT_FAILURE);
+	}
+	strcpy(address.sun_path, path);
+	unlink(path);
+	const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == -1 || bind(listener, (struct sockaddr*)&address, sizeof address) != 0
+		|| listen(listener, SOMAXCONN) != 0) {
+		fprintf(stderr, "Error: Failed to listen on '%s'\n", path);
+		exit(EXIT_FAILURE);
+	}
+	return listener;
+}
+
+// Returns false if the connection did not carry a request
+static bool _receive(int connection, char* kind, int fds[FD_COUNT]) {
+	struct iovec data = { .iov_base = kind, .iov_len = 1 };
+	union {
+		struct cmsghdr	header;
+		char			space[CMSG_SPACE(FD_COUNT * sizeof(int))];
+	} control;
+	struct msghdr message = {
+		.msg_iov = &data,
+		.msg_iovlen = 1,
+		.msg_control = control.space,
+		.msg_controllen = sizeof control.space,
+	};
+	if (recvmsg(connection, &message, 0) != 1) {
+		return false;
+	}
+	struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+	if (header == NULL || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(FD_COUNT * sizeof(int))) {
+		return false;
+	}
+	memcpy(fds, CMSG_DATA(header), FD_COUNT * sizeof(int));
+	return true;
+}
+
+static void _answer(int connection, uint8_t code) {
+	write(connection, &code, 1);
+	close(connection);
+}
+
+static void _closeAll(const int fds[FD_COUNT]) {
+	for (int i = 0; i < FD_COUNT; ++i) {
+		close(fds[i]);
+	}
+}
+
+static void _reap(void) {
+	int status;
+	pid_t child;
+	while ((child = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (size_t i = 0; i < requestCount; ++i) {
+			if (requests[i].child == child) {
+				_answer(requests[i].connection, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+				requests[i] = requests[--requestCount];
+				break;
+			}
+		}
+	}
+}
+
+// Returns false in the parent, true in the child that serves the request
+static bool _fork(int listener, int connection, const int fds[FD_COUNT]) {
+	nativeFlush();
+	fflush(stdout);
+	fflush(stderr);
+	const pid_t child = fork();
+	if (child == 0) {
+		close(listener);
+		close(connection);
+		for (size_t i = 0; i < requestCount; ++i) {
+			close(requests[i].connection);
+		}
+		for (int i = 0; i < FD_COUNT; ++i) {
+			dup2(fds[i], i);
+			close(fds[i]);
+		}
+		signal(SIGCHLD, SIG_DFL);
+		poolForked();
+		return true;
+	}
+	_closeAll(fds);
+	if (child == -1) {
+		_answer(connection, EXIT_FAILURE);
+		return false;
+	}
+	if (requestCount == requestCapacity) {
+		requestCapacity = requestCapacity == 0 ? 16 : requestCapacity * 2;
+		requests = memoryReallocate(requests, requestCapacity * sizeof *requests, MEMORY_ANALYSIS);
+	}
+	requests[requestCount].child = child;
+	requests[requestCount].connection = connection;
+	++requestCount;
+	return false;
+}
+
+static void _handleSignals(void) {
+	struct sigaction action = { .sa_handler = _onChild };
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGCHLD, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+}
+
+// Returns -1 when poll() was interrupted by a child that exited
+static int _accept(int listener) {
+	_reap();
+	struct pollfd ready = { .fd = listener, .events = POLLIN };
+	if (poll(&ready, 1, -1) != 1) {
+		return -1;
+	}
+	return accept(listener, NULL, NULL);
+}
+
+// Runs the global initializers and serves requests, only returns in a child, which then runs the top level
+// statements of 'root' (see evalStatements())
+void serverRun(const char* path, ParseNode* root) {
+	evalGlobals(root);
+	const int listener = _listen(path);
+	_handleSignals();
+	while (true) {
+		const int connection = _accept(listener);
+		if (connection == -1) {
+			continue;
+		}
+		char kind;
+		int fds[FD_COUNT];
+		if (!_receive(connection, &kind, fds)) {
+			close(connection);
+			continue;
+		}
+		if (_fork(listener, connection, fds)) {
+			signal(SIGPIPE, SIG_DFL);
+			return;
+		}
+	}
+}
+
+// NOTE:	The daemon (--daemon) runs any script that is submitted to it, and keeps the compiled programs in a cache
+//			- A request is REQUEST_RUN with the script's size (8 bytes) and source after it, or REQUEST_STATS,
+//			  both with the client's descriptors attached like a fork server request
+//			- Programs are looked up by the SHA-256 of their source, a hit skips tokenizing, parsing, resolving
+//			  and inferring
+//			- The least recently used programs are dropped once their trees take more than the cache limit
+//			- Every request runs in a fork() of the daemon, a fresh interpreter whose changes the cache never sees
+//			- Compile errors go to the client's stderr and leave the daemon running
+#define REQUEST_RUN		'R'
+#define REQUEST_STATS	'S'
+#define DIGEST_SIZE		32
+#define MAX_SOURCE_SIZE	((uint64_t)1 << 30)
+#define RECEIVE_TIMEOUT	10	// Seconds, a client that stalls in the middle of its source is dropped
+
+typedef struct Program	Program;
+struct Program {
+	uint8_t		digest[DIGEST_SIZE];
+	ParseNode*	root;
+	size_t		bytes;
+	uint64_t	lastUse;
+};
+
+static Program* programs = NULL;
+static size_t programCount = 0;
+static size_t programCapacity = 0;
+static size_t cachedBytes = 0;
+static size_t cacheLimit = 0;
+static size_t inlineLimit = 0;	// 0 for no inlining
+static uint64_t useClock = 0;
+static size_t hits = 0;
+static size_t misses = 0;
+static size_t evictions = 0;
+
+static const uint32_t roundConstants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t _rotate(uint32_t x, int n) {
+	return x >> n | x << (32 - n);
+}
+
+static void _compress(uint32_t state[8], const uint8_t block[64]) {
+	uint32_t w[64];
+	for (int i = 0; i < 16; ++i) {
+		w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8
+			| block[4 * i + 3];
+	}
+	for (int i = 16; i < 64; ++i) {
+		const uint32_t s0 = _rotate(w[i - 15], 7) ^ _rotate(w[i - 15], 18) ^ w[i - 15] >> 3;
+		const uint32_t s1 = _rotate(w[i - 2], 17) ^ _rotate(w[i - 2], 19) ^ w[i - 2] >> 10;
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	uint32_t v[8];
+	memcpy(v, state, sizeof v);
+	for (int i = 0; i < 64; ++i) {
+		const uint32_t s1 = _rotate(v[4], 6) ^ _rotate(v[4], 11) ^ _rotate(v[4], 25);
+		const uint32_t choice = (v[4] & v[5]) ^ (~v[4] & v[6]);
+		const uint32_t t1 = v[7] + s1 + choice + roundConstants[i] + w[i];
+		const uint32_t s0 = _rotate(v[0], 2) ^ _rotate(v[0], 13) ^ _rotate(v[0], 22);
+		const uint32_t majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+		memmove(v + 1, v, 7 * sizeof *v);
+		v[4] += t1;
+		v[0] = t1 + s0 + majority;
+	}
+	for (int i = 0; i < 8; ++i) {
+		state[i] += v[i];
+	}
+}
+
+static void _sha256(const char* chars, size_t size, uint8_t digest[DIGEST_SIZE]) {
+	uint32_t state[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	size_t done = 0;
+	for (; size - done >= 64; done += 64) {
+		_compress(state, (const uint8_t*)chars + done);
+	}
+	// The rest, a 1 bit, zeros and the size in bits take one or two more blocks
+	uint8_t last[128] = {};
+	const size_t rest = size - done;
+	memcpy(last, chars + done, rest);
+	last[rest] = 0x80;
+	const size_t blocks = rest < 56 ? 1 : 2;
+	const uint64_t bits = (uint64_t)size * 8;
+	for (int i = 0; i < 8; ++i) {
+		last[blocks * 64 - 1 - i] = bits >> (8 * i);
+	}
+	for (size_t i = 0; i < blocks; ++i) {
+		_compress(state, last + 64 * i);
+	}
+	for (int i = 0; i < 8; ++i) {
+		digest[4 * i] = state[i] >> 24;
+		digest[4 * i + 1] = state[i] >> 16;
+		digest[4 * i + 2] = state[i] >> 8;
+		digest[4 * i + 3] = state[i];
+	}
+}
+
+static bool _readAll(int fd, void* buffer, size_t size) {
+	for (size_t done = 0; done < size;) {
+		const ssize_t length = read(fd, (char*)buffer + done, size - done);
+		if (length <= 0) {
+			return false;
+		}
+		done += length;
+	}
+	return true;
+}
+
+static bool _writeAll(int fd, const void* buffer, size_t size) {
+	for (size_t done = 0; done < size;) {
+		const ssize_t length = write(fd, (const char*)buffer + done, size - done);
+		if (length <= 0) {
+			return false;
+		}
+		done += length;
+	}
+	return true;
+}
+
+// What the cache counts for a program, its nodes and string literals
+static size_t _treeBytes(const ParseNode* node) {
+	size_t bytes = node->childCapacity * sizeof *node->children;
+	if (node->syntax == TOKEN_STRING) {
+		bytes += strlen(node->data.stringLiteral) + 1;
+	}
+	for (uint32_t i = 0; i < node->childCount; ++i) {
+		bytes += _treeBytes(&node->children[i]);
+	}
+	return bytes;
+}
+
+// Returns NULL after reporting an error, bodies are parsed now so that they are parsed once for every request
+static ParseNode* _compile(const char* chars, size_t size) {
+	TokenList list;
+	if (!tokenizeChecked(chars, size, false, &list)) {
+		return NULL;
+	}
+	ParseNode* root = parseProgram(&list, false);
+	if (root == NULL) {
+		return NULL;
+	}
+	// Programs of the cache are independent, and evicted ones are freed
+	resolveReset();
+	inferReset();
+	if (!resolveProgramChecked(root)) {
+		parseTreeFree(root);
+		memoryFree(root);
+		return NULL;
+	}
+	inferProgram(root);
+	if (inlineLimit != 0) {
+		inlineProgram(root, inlineLimit);
+	}
+	return root;
+}
+
+static void _evict(size_t i) {
+	cachedBytes -= programs[i].bytes;
+	parseTreeFree(programs[i].root);
+	memoryFree(programs[i].root);
+	programs[i] = programs[--programCount];
+	++evictions;
+}
+
+// Makes room for 'bytes' more, returns false if the program cannot be cached at all
+static bool _reserve(size_t bytes) {
+	if (bytes > cacheLimit) {
+		return false;
+	}
+	while (cachedBytes + bytes > cacheLimit) {
+		size_t oldest = 0;
+		for (size_t i = 1; i < programCount; ++i) {
+			if (programs[i].lastUse < programs[oldest].lastUse) {
+				oldest = i;
+			}
+		}
+		_evict(oldest);
+	}
+	return true;
+}
+
+static Program* _find(const uint8_t digest[DIGEST_SIZE]) {
+	for (size_t i = 0; i < programCount; ++i) {
+		if (memcmp(programs[i].digest, digest, DIGEST_SIZE) == 0) {
+			return &programs[i];
+		}
+	}
+	return NULL;
+}
+
+static void _insert(const uint8_t digest[DIGEST_SIZE], ParseNode* root, size_t bytes) {
+	if (programCount == programCapacity) {
+		programCapacity = programCapacity == 0 ? 16 : programCapacity * 2;
+		programs = memoryReallocate(programs, programCapacity * sizeof *programs, MEMORY_ANALYSIS);
+	}
+	Program* program = &programs[programCount++];
+	memcpy(program->digest, digest, DIGEST_SIZE);
+	program->root = root;
+	program->bytes = bytes;
+	program->lastUse = ++useClock;
+	cachedBytes += bytes;
+}
+
+// The program for the source that follows a REQUEST_RUN, NULL if it could not be read or compiled
+static ParseNode* _lookup(int connection, int errors, bool* cached) {
+	uint64_t size;
+	if (!_readAll(connection, &size, sizeof size) || size > MAX_SOURCE_SIZE) {
+		return NULL;
+	}
+	char* chars = memoryAllocate(size, MEMORY_SOURCE);
+	if (!_readAll(connection, chars, size)) {
+		memoryFree(chars);
+		return NULL;
+	}
+	uint8_t digest[DIGEST_SIZE];
+	_sha256(chars, size, digest);
+	Program* program = _find(digest);
+	if (program != NULL) {
+		memoryFree(chars);
+		++hits;
+		program->lastUse = ++useClock;
+		*cached = true;
+		return program->root;
+	}
+	++misses;
+	// Compile errors are the client's
+	fflush(stderr);
+	const int saved = dup(STDERR_FILENO);
+	dup2(errors, STDERR_FILENO);
+	ParseNode* root = _compile(chars, size);
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+	memoryFree(chars);
+	if (root == NULL) {
+		return NULL;
+	}
+	const size_t bytes = sizeof *root + _treeBytes(root);
+	*cached = _reserve(bytes);
+	if (*cached) {
+		_insert(digest, root, bytes);
+	}
+	return root;
+}
+
+// Serves requests until it is killed, only returns in a child, which then runs the returned program
+ParseNode* serverDaemon(const char* path, size_t limit, size_t inlining) {
+	cacheLimit = limit;
+	inlineLimit = inlining;
+	const int listener = _listen(path);
+	_handleSignals();
+	const struct timeval timeout = { .tv_sec = RECEIVE_TIMEOUT };
+	while (true) {
+		const int connection = _accept(listener);
+		if (connection == -1) {
+			continue;
+		}
+		setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+		char kind;
+		int fds[FD_COUNT];
+		if (!_receive(connection, &kind, fds)) {
+			close(connection);
+			continue;
+		}
+		if (kind == REQUEST_STATS) {
+			dprintf(fds[1], "%zu programs, %zu of %zu bytes, %zu hits, %zu misses, %zu evictions\n",
+				programCount, cachedBytes, cacheLimit, hits, misses, evictions);
+			_closeAll(fds);
+			_answer(connection, EXIT_SUCCESS);
+			continue;
+		}
+		bool cached = false;
+		ParseNode* root = kind == REQUEST_RUN ? _lookup(connection, fds[2], &cached) : NULL;
+		if (root == NULL) {
+			_closeAll(fds);
+			_answer(connection, EXIT_FAILURE);
+			continue;
+		}
+		if (_fork(listener, connection, fds)) {
+			signal(SIGPIPE, SIG_DFL);
+			return root;
+		}
+		if (!cached) {
+			parseTreeFree(root);
+			memoryFree(root);
+		}
+	}
+}
+
+// Sends a request with this process's stdin, stdout and stderr attached and returns its exit status
+static int _request(const char* path, char kind, const char* chars, size_t size) {
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof address.sun_path) {
+		fprintf(stderr, "Error: Socket path '%s' is too long\n", path);
+		return EXIT_FAILURE;
+	}
+	strcpy(address.sun_path, path);
+	const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connection == -1 || connect(connection, (struct sockaddr*)&address, sizeof address) != 0) {
+		fprintf(stderr, "Error: Failed to connect to '%s'\n", path);
+		return EXIT_FAILURE;
+	}
+	struct iovec data = { .iov_base = &kind, .iov_len = 1 };
+	union {
+		struct cmsghdr	header;
+		char			space[CMSG_SPACE(FD_COUNT * sizeof(int))];
+	} control;
+	memset(&control, 0, sizeof control);
+	struct msghdr message = {
+		.msg_iov = &data,
+		.msg_iovlen = 1,
+		.msg_control = control.space,
+		.msg_controllen = sizeof control.space,
+	};
+	struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(FD_COUNT * sizeof(int));
+	const int fds[FD_COUNT] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	memcpy(CMSG_DATA(header), fds, sizeof fds);
+	const uint64_t length = size;
+	uint8_t code;
+	const bool sent = sendmsg(connection, &message, 0) == 1 && (kind != REQUEST_RUN
+		|| (_writeAll(connection, &length, sizeof length) && _writeAll(connection, chars, size)));
+	if (!sent || read(connection, &code, 1) != 1) {
+		fprintf(stderr, "Error: The server at '%s' did not answer\n", path);
+		close(connection);
+		return EXIT_FAILURE;
+	}
+	close(connection);
+	return code;
+}
+
+// Asks a fork server to run its script
+int serverConnect(const char* path) {
+	return _request(path, 0, NULL, 0);
+}
+
+// Asks a daemon to run the script in 'chars'
+int serverSubmit(const char* path, const char* chars, size_t size) {
+	return _request(path, REQUEST_RUN, chars, size);
+}
+
+// Prints the cache statistics of a daemon
+int serverStats(const char* path) {
+	return _request(path, REQUEST_STATS, NULL, 0);
+}
@@ -6,18 +6,40 @@
 #include <ctype.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <setjmp.h>
 
-#define KEYWORD_COUNT	9
+// NOTE:	Large sources are tokenized in parallel, see tokenize()
+//			- Chunks end after a newline outside of string literals, where no token can continue
+//			- A string literal ends at the next '"' whatever precedes it, so the parity of the number of
+//			  quotes before a position tells whether it is inside a literal
+//			- Errors in a chunk are kept until all chunks are done, so the first one in the source is reported
+#define PARALLEL_MIN_SIZE	(4 * 1024 * 1024)
+#define MIN_CHUNK_SIZE		(256 * 1024)
+#define CHUNKS_PER_THREAD	4
+#define MAX_ERROR_LENGTH	96
+// Lists are allocated from the size of the source, about 3 characters per token and 7 per payload
+#define CHARS_PER_TOKEN		3
+#define CHARS_PER_DATA		6
+
+#define KEYWORD_COUNT	16
 static const char* keywords[KEYWORD_COUNT] = {
+	"and",
+	"bench",
 	"do",
 	"else",
 	"end",
 	"fn",
+	"for",
 	"if",
+	"import",
+	"or",
+	"parallel",
 	"return",
 	"then",
 	"var",
 	"while",
+	"yield",
 };
 
 static void _printSyntaxString(const char* s) {
@@ -30,8 +52,11 @@ void printSyntax(Syntax s) {
 	CASE(TOKEN_INTEGER);
 	CASE(TOKEN_STRING);
 	CASE(TOKEN_COMMA);
+	CASE(TOKEN_DOT);
 	CASE(TOKEN_L_PAREN);
 	CASE(TOKEN_R_PAREN);
+	CASE(TOKEN_L_BRACKET);
+	CASE(TOKEN_R_BRACKET);
 	CASE(TOKEN_PLUS);
 	CASE(TOKEN_MINUS);
 	CASE(TOKEN_MULTIPLY);
@@ -44,15 +69,22 @@ void printSyntax(Syntax s) {
 	CASE(TOKEN_NOT_EQUAL);
 	CASE(TOKEN_GREATER_EQUAL);
 	CASE(TOKEN_LESS_EQUAL);
+	CASE(TOKEN_AND);
+	CASE(TOKEN_BENCH);
 	CASE(TOKEN_DO);
 	CASE(TOKEN_ELSE);
 	CASE(TOKEN_END);
 	CASE(TOKEN_FN);
+	CASE(TOKEN_FOR);
 	CASE(TOKEN_IF);
+	CASE(TOKEN_IMPORT);
+	CASE(TOKEN_OR);
+	CASE(TOKEN_PARALLEL);
 	CASE(TOKEN_RETURN);
 	CASE(TOKEN_THEN);
 	CASE(TOKEN_VAR);
 	CASE(TOKEN_WHILE);
+	CASE(TOKEN_YIELD);
 	CASE(SYNTAX_PROGRAM);
 	CASE(SYNTAX_FUNCTION);
 	CASE(SYNTAX_BLOCK);
@@ -64,6 +96,27 @@ void printSyntax(Syntax s) {
 	CASE(SYNTAX_RETURN);
 	CASE(SYNTAX_IF);
 	CASE(SYNTAX_WHILE);
+	CASE(SYNTAX_FOR);
+	CASE(SYNTAX_PARALLEL_FOR);
+	CASE(SYNTAX_INDEX);
+	CASE(SYNTAX_INDEX_ASSIGNMENT);
+	CASE(SYNTAX_YIELD);
+	CASE(SYNTAX_LAZY_BLOCK);
+	CASE(SYNTAX_IMPORT);
+	CASE(SYNTAX_BENCH);
+	CASE(RUNTIME_NATIVE_FUNCTION);
+	CASE(RUNTIME_KNOWN_FUNCTION);
+	CASE(RUNTIME_GENERATOR_CALL);
+	CASE(RUNTIME_INLINED_CALL);
+	CASE(RUNTIME_KNOWN_VARIABLE);
+	CASE(RUNTIME_KNOWN_GLOBAL_VARIABLE);
+	CASE(RUNTIME_COUNTED_WHILE);
+	CASE(RUNTIME_REDUCTIONS);
+	CASE(RUNTIME_LOCAL_OP_CONST);
+	CASE(RUNTIME_LOCAL_OP_LOCAL);
+	CASE(RUNTIME_GLOBAL_OP_CONST);
+	CASE(RUNTIME_INCREMENT_LOCAL);
+	CASE(RUNTIME_INCREMENT_GLOBAL);
 	default:
 		fprintf(stderr, "Error: Unknown syntax item %#hhx\n", s);
 		exit(EXIT_FAILURE);
@@ -71,12 +124,91 @@ void printSyntax(Syntax s) {
 }
 #undef CASE
 
+// A token as it is read, before addToken() splits it into the arrays of a TokenList
+typedef struct {
+	TokenData	data;
+	Syntax		syntax;
+} Token;
+
+typedef struct Chunk	Chunk;
+struct Chunk {
+	const char*	begin;
+	const char*	end;
+	size_t		quotes;		// Number of '"' between the nominal start of the chunk and the next one
+	size_t		offset;		// Index of the first token of the chunk in the final list
+	size_t		dataOffset;
+	TokenList	list;
+	jmp_buf		failed;
+	char		error[MAX_ERROR_LENGTH];	// Empty unless tokenizing the chunk failed
+};
+
+typedef struct Split	Split;
+struct Split {
+	const char*	chars;
+	size_t		count;
+	Chunk*		chunks;
+	size_t		chunkCount;
+	TokenList*	list;
+};
+
+// Chunk that the calling thread is tokenizing, NULL when tokenizing sequentially
+static __thread Chunk* currentChunk = NULL;
+
+__attribute__((noreturn)) static void _fail(const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	if (currentChunk != NULL) {
+		vsnprintf(currentChunk->error, MAX_ERROR_LENGTH, format, args);
+		va_end(args);
+		longjmp(currentChunk->failed, 1);
+	}
+	vfprintf(stderr, format, args);
+	va_end(args);
+	exit(EXIT_FAILURE);
+}
+
+static TokenList _reserve(size_t tokenCapacity, size_t dataCapacity) {
+	TokenList list = {
+		.syntax = memoryAllocate(tokenCapacity * sizeof *list.syntax, MEMORY_TOKENS),
+		.data = memoryAllocate(dataCapacity * sizeof *list.data, MEMORY_TOKENS),
+		.tokenCapacity = tokenCapacity,
+		.dataCapacity = dataCapacity,
+	};
+	return list;
+}
+
+static TokenList _estimate(size_t size) {
+	return _reserve(size / CHARS_PER_TOKEN + 16, size / CHARS_PER_DATA + 16);
+}
+
 static void addToken(TokenList* list, Token t) {
 	if (list->tokenCount == list->tokenCapacity) {
 		list->tokenCapacity *= 2;
-		list->tokens = realloc(list->tokens, list->tokenCapacity * sizeof *list->tokens);
+		list->syntax = memoryReallocate(list->syntax, list->tokenCapacity * sizeof *list->syntax, MEMORY_TOKENS);
+		if (list->offsets != NULL) {
+			list->offsets = memoryReallocate(list->offsets, list->tokenCapacity * sizeof *list->offsets,
+				MEMORY_TOKENS);
+		}
+	}
+	list->syntax[list->tokenCount++] = t.syntax;
+	if (!TOKEN_HAS_DATA(t.syntax)) {
+		return;
+	}
+	if (list->dataCount == list->dataCapacity) {
+		list->dataCapacity *= 2;
+		list->data = memoryReallocate(list->data, list->dataCapacity * sizeof *list->data, MEMORY_TOKENS);
 	}
-	list->tokens[list->tokenCount++] = t;
+	list->data[list->dataCount++] = t.data;
+}
+
+// hash() keeps the characters of short names as they are, so tables mix the bits before they pick a slot
+uint64_t hashMix(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111eb;
+	x ^= x >> 31;
+	return x;
 }
 
 uint64_t hash(const uint8_t* data, size_t size) {
@@ -101,12 +233,13 @@ static Token readIdentifierOrKeyword(const char** const chars, const char* const
 		const size_t keywordLength = strlen(keywords[i]);
 		const size_t l = length > keywordLength ? length : keywordLength;
 		if (strncmp(begin, keywords[i], l) == 0) {
-			t.syntax = TOKEN_DO + i;
+			t.syntax = TOKEN_AND + i;
 			return t;
 		}
 	}
 	t.syntax = TOKEN_IDENTIFIER;
 	t.data.identifier = hash((const uint8_t*)begin, length);
+	traceName(t.data.identifier, begin, length);
 	return t;
 }
 
@@ -116,8 +249,9 @@ static Token readIntegerLiteral(const char** const chars, const char* const end)
 		if (!isdigit(**chars)) {
 			break;
 		}
-		value *= 10;
-		value += (int64_t)(**chars - '0');
+		if (__builtin_mul_overflow(value, 10, &value) || __builtin_add_overflow(value, **chars - '0', &value)) {
+			_fail("Error: Integer literal is too large\n");
+		}
 		++*chars;
 	}
 	Token t = {
@@ -136,8 +270,7 @@ static char _readEscapeSequence(const char** const chars, const char* const end)
 			return '\\';
 		}
 	}
-	fprintf(stderr, "Error: Reached end of string literal before end of escape sequence\n");
-	exit(EXIT_FAILURE);
+	_fail("Error: Reached end of string literal before end of escape sequence\n");
 }
 
 // NOTE: Supported escape sequences are \\ and \n
@@ -161,12 +294,11 @@ static Token readStringLiteral(const char** const chars, const char* const end)
 		++*chars;
 	}
 	if (*chars == end) {
-		fprintf(stderr, "Error: Reached end of characters before terminating '\"' of string literal\n");
-		exit(EXIT_FAILURE);
+		_fail("Error: Reached end of characters before terminating '\"' of string literal\n");
 	}
 	const size_t length = *chars - begin;
 	const size_t actualLength = length - extra;
-	char* const string = malloc(actualLength + 1);
+	char* const string = memoryAllocate(actualLength + 1, MEMORY_TOKENS);
 	const char* prev = begin;
 	const char* where;
 	char* dst = string;
@@ -198,14 +330,10 @@ static Token readOperator(const char** const chars, const char* const end, Synta
 	return t;
 }
 
-TokenList tokenize(const char* chars, size_t count) {
-	TokenList list = {
-		.tokenCapacity = 16,
-		.tokenCount = 0,
-		.tokens = malloc(16 * sizeof *list.tokens),
-	};
-	const char* const end = chars + count;
+static void tokenizeRange(TokenList* list, const char* chars, const char* const end) {
+	const char* const begin = chars;
 	while (chars < end) {
+		const char* const start = chars;
 		Token t = {};
 		switch (*chars) {
 		case '_':
@@ -272,6 +400,7 @@ TokenList tokenize(const char* chars, size_t count) {
 		case '6':
 		case '7':
 		case '8':
+		case '9':
 			t = readIntegerLiteral(&chars, end);
 			break;
 		case '"':
@@ -281,6 +410,10 @@ TokenList tokenize(const char* chars, size_t count) {
 			t.syntax = TOKEN_COMMA;
 			++chars;
 			break;
+		case '.':
+			t.syntax = TOKEN_DOT;
+			++chars;
+			break;
 		case '(':
 			t.syntax = TOKEN_L_PAREN;
 			++chars;
@@ -289,6 +422,14 @@ TokenList tokenize(const char* chars, size_t count) {
 			t.syntax = TOKEN_R_PAREN;
 			++chars;
 			break;
+		case '[':
+			t.syntax = TOKEN_L_BRACKET;
+			++chars;
+			break;
+		case ']':
+			t.syntax = TOKEN_R_BRACKET;
+			++chars;
+			break;
 		case '+':
 			t.syntax = TOKEN_PLUS;
 			++chars;
@@ -323,12 +464,155 @@ TokenList tokenize(const char* chars, size_t count) {
 			++chars;
 			break;
 		default:
-			fprintf(stderr, "Error: Unknown character '%#hhx'\n", *chars);
-			exit(EXIT_FAILURE);
+			_fail("Error: Unknown character '%#hhx'\n", *chars);
 		}
 		if (t.syntax != SYNTAX_NONE) {
-			addToken(&list, t);
+			addToken(list, t);
+			if (list->offsets != NULL) {
+				list->offsets[list->tokenCount - 1] = start - begin;
+			}
 		}
 	}
+}
+
+static const char* _nominalStart(const Split* split, size_t i) {
+	return split->chars + split->count / split->chunkCount * i;
+}
+
+static void _countQuotes(void* context, size_t i) {
+	const Split* split = context;
+	const char* c = _nominalStart(split, i);
+	const char* const end = i + 1 == split->chunkCount ? split->chars + split->count : _nominalStart(split, i + 1);
+	size_t quotes = 0;
+	while ((c = memchr(c, '"', end - c)) != NULL) {
+		++quotes;
+		++c;
+	}
+	split->chunks[i].quotes = quotes;
+}
+
+// Moves the start of every chunk after its nominal start to the next newline outside of a string literal
+static void _findBoundaries(Split* split) {
+	const char* const end = split->chars + split->count;
+	size_t quotes = 0;
+	split->chunks[0].begin = split->chars;
+	for (size_t i = 1; i < split->chunkCount; ++i) {
+		quotes += split->chunks[i - 1].quotes;
+		const char* c = _nominalStart(split, i);
+		bool inString = quotes % 2 == 1;
+		// The previous chunk may already have been extended past this one
+		if (c < split->chunks[i - 1].begin) {
+			c = split->chunks[i - 1].begin;
+			inString = false;
+		}
+		while (c != end && (inString || *c != '\n')) {
+			inString ^= *c == '"';
+			++c;
+		}
+		split->chunks[i].begin = c == end ? end : c + 1;
+		split->chunks[i - 1].end = split->chunks[i].begin;
+	}
+	split->chunks[split->chunkCount - 1].end = end;
+}
+
+// Errors are kept in the chunk instead of ending the process
+static void _tokenizeCaught(Chunk* chunk) {
+	chunk->error[0] = '\0';
+	currentChunk = chunk;
+	if (setjmp(chunk->failed) == 0) {
+		tokenizeRange(&chunk->list, chunk->begin, chunk->end);
+	}
+	currentChunk = NULL;
+}
+
+static void _tokenizeChunk(void* context, size_t i) {
+	Chunk* chunk = &((Split*)context)->chunks[i];
+	chunk->list = _estimate(chunk->end - chunk->begin);
+	_tokenizeCaught(chunk);
+}
+
+static void _copyChunk(void* context, size_t i) {
+	const Split* split = context;
+	Chunk* chunk = &split->chunks[i];
+	const TokenList* from = &chunk->list;
+	memcpy(split->list->syntax + chunk->offset, from->syntax, from->tokenCount * sizeof *from->syntax);
+	memcpy(split->list->data + chunk->dataOffset, from->data, from->dataCount * sizeof *from->data);
+	memoryFree(from->syntax);
+	memoryFree(from->data);
+}
+
+// NOTE:	The result is the same as tokenizing the whole source sequentially
+static TokenList tokenizeParallel(const char* chars, size_t count, size_t chunkCount) {
+	Split split = {
+		.chars = chars,
+		.count = count,
+		.chunks = memoryAllocateZeroed(chunkCount * sizeof *split.chunks, MEMORY_TOKENS),
+		.chunkCount = chunkCount,
+	};
+	poolRun(_countQuotes, &split, chunkCount);
+	_findBoundaries(&split);
+	poolRun(_tokenizeChunk, &split, chunkCount);
+	size_t tokenCount = 0;
+	size_t dataCount = 0;
+	for (size_t i = 0; i < chunkCount; ++i) {
+		if (split.chunks[i].error[0] != '\0') {
+			fputs(split.chunks[i].error, stderr);
+			exit(EXIT_FAILURE);
+		}
+		split.chunks[i].offset = tokenCount;
+		split.chunks[i].dataOffset = dataCount;
+		tokenCount += split.chunks[i].list.tokenCount;
+		dataCount += split.chunks[i].list.dataCount;
+	}
+	TokenList list = _reserve(tokenCount + 1, dataCount + 1);
+	list.tokenCount = tokenCount;
+	list.dataCount = dataCount;
+	split.list = &list;
+	poolRun(_copyChunk, &split, chunkCount);
+	memoryFree(split.chunks);
 	return list;
 }
+
+TokenList tokenize(const char* chars, size_t count) {
+	if (count >= PARALLEL_MIN_SIZE && poolThreadCount() > 1) {
+		size_t chunkCount = poolThreadCount() * CHUNKS_PER_THREAD;
+		if (count / chunkCount < MIN_CHUNK_SIZE) {
+			chunkCount = count / MIN_CHUNK_SIZE;
+		}
+		return tokenizeParallel(chars, count, chunkCount);
+	}
+	TokenList list = _estimate(count);
+	tokenizeRange(&list, chars, chars + count);
+	return list;
+}
+
+// Reports an error and returns false instead of ending the process, 'list' is then empty
+// With 'offsets' the list keeps the source offset of every token, which watch mode maps back to the source
+bool tokenizeChecked(const char* chars, size_t count, bool offsets, TokenList* list) {
+	Chunk chunk = {
+		.begin = chars,
+		.end = chars + count,
+		.list = _estimate(count),
+	};
+	if (offsets) {
+		chunk.list.offsets = memoryAllocate(chunk.list.tokenCapacity * sizeof *chunk.list.offsets, MEMORY_TOKENS);
+	}
+	_tokenizeCaught(&chunk);
+	if (chunk.error[0] != '\0') {
+		fputs(chunk.error, stderr);
+		const TokenData* data = chunk.list.data;
+		for (size_t i = 0; i < chunk.list.tokenCount; ++i) {
+			if (chunk.list.syntax[i] == TOKEN_STRING) {
+				memoryFree((void*)data->stringLiteral);
+			}
+			data += TOKEN_HAS_DATA(chunk.list.syntax[i]);
+		}
+		memoryFree(chunk.list.syntax);
+		memoryFree(chunk.list.data);
+		memoryFree(chunk.list.offsets);
+		memset(list, 0, sizeof *list);
+		return false;
+	}
+	*list = chunk.list;
+	return true;
+}
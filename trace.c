@@ -0,0 +1,249 @@
+#define _POSIX_C_SOURCE 200809L
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// NOTE:	The trace (--trace <file>) records what the interpreter did over time, and is written at exit in the
+//			Chrome trace event format (chrome://tracing, Perfetto)
+//			- Events are function calls, phases of the interpreter and 'while' loops that ran for at least
+//			  MIN_LOOP_NANOSECONDS, every one with a CLOCK_MONOTONIC timestamp
+//			- Every thread records into a ring buffer of its own without locking, only its creation is atomic,
+//			  and the last BUFFER_CAPACITY events of each thread are kept
+//			- Calls record the hash() of the function name, names are collected by the tokenizer (see traceName())
+//			  into a table of the thread, as the pool tokenizes large sources, and the tables are merged when the
+//			  file is written
+//			- Inlined calls and generator bodies are not recorded, --no-inline shows every call
+#define BUFFER_CAPACITY			(1 << 18)	// Power of 2
+#define MIN_LOOP_NANOSECONDS	100000
+#define INITIAL_NAME_CAPACITY	64
+
+enum {
+	EVENT_ENTER,	// 'value' is the hash() of the function name
+	EVENT_EXIT,
+	EVENT_PHASE,	// 'value' is the name, NULL when the phase ends
+	EVENT_LOOP,		// 'time' is when the loop started, 'value' how long it ran
+};
+
+typedef struct Event	Event;
+struct Event {
+	uint64_t	time;
+	uint64_t	value;
+	uint8_t		kind;
+};
+
+typedef struct Name	Name;
+struct Name {
+	uint64_t	identifier;
+	char*		chars;	// NULL for an empty slot
+};
+
+typedef struct Names	Names;
+struct Names {
+	Name*	slots;
+	size_t	count;
+	size_t	capacity;
+};
+
+typedef struct Buffer	Buffer;
+struct Buffer {
+	Event*		events;
+	size_t		count;	// Of events recorded, including those that were overwritten
+	uint32_t	thread;
+	Names		names;	// Seen by the tokenizer on this thread
+	Buffer*		next;
+};
+
+static const char* path = NULL;	// NULL when not tracing
+static uint64_t start = 0;
+static __thread Buffer* buffer = NULL;
+static Buffer* buffers = NULL;	// Of every thread
+static uint32_t threadCount = 0;
+static Names names = {};	// Of every thread, merged when the file is written
+
+static uint64_t _now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+__attribute__((noinline)) static void _createBuffer(void) {
+	buffer = memoryAllocate(sizeof *buffer, MEMORY_TRACE);
+	buffer->events = memoryAllocate(BUFFER_CAPACITY * sizeof *buffer->events, MEMORY_TRACE);
+	buffer->count = 0;
+	buffer->names = (Names){};
+	buffer->thread = __atomic_fetch_add(&threadCount, 1, __ATOMIC_RELAXED);
+	buffer->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&buffers, &buffer->next, buffer, true, __ATOMIC_RELEASE,
+		__ATOMIC_RELAXED)) {
+	}
+}
+
+static void _record(uint8_t kind, uint64_t time, uint64_t value) {
+	if (buffer == NULL) {
+		_createBuffer();
+	}
+	Event* event = &buffer->events[buffer->count++ & (BUFFER_CAPACITY - 1)];
+	event->time = time;
+	event->value = value;
+	event->kind = kind;
+}
+
+void traceEnter(uint64_t identifier) {
+	_record(EVENT_ENTER, _now(), identifier);
+}
+
+void traceExit(void) {
+	_record(EVENT_EXIT, _now(), 0);
+}
+
+uint64_t traceLoopBegin(void) {
+	return _now();
+}
+
+void traceLoopEnd(uint64_t begin) {
+	const uint64_t end = _now();
+	if (end - begin >= MIN_LOOP_NANOSECONDS) {
+		_record(EVENT_LOOP, begin, end - begin);
+	}
+}
+
+// 'name' must outlive the trace, NULL ends the phase that was begun last
+void tracePhase(const char* name) {
+	if (path != NULL) {
+		_record(EVENT_PHASE, _now(), (uintptr_t)name);
+	}
+}
+
+static Name* _findName(const Names* table, uint64_t identifier) {
+	size_t i = hashMix(identifier) & (table->capacity - 1);
+	while (table->slots[i].chars != NULL && table->slots[i].identifier != identifier) {
+		i = (i + 1) & (table->capacity - 1);
+	}
+	return &table->slots[i];
+}
+
+// Returns the slot of 'identifier', an empty one if the name is not in the table yet
+static Name* _addName(Names* table, uint64_t identifier) {
+	if ((table->count + 1) * 2 > table->capacity) {
+		Names old = *table;
+		table->capacity = old.capacity == 0 ? INITIAL_NAME_CAPACITY : old.capacity * 2;
+		table->slots = memoryAllocateZeroed(table->capacity * sizeof *table->slots, MEMORY_TRACE);
+		for (size_t i = 0; i < old.capacity; ++i) {
+			if (old.slots[i].chars != NULL) {
+				*_findName(table, old.slots[i].identifier) = old.slots[i];
+			}
+		}
+		memoryFree(old.slots);
+	}
+	return _findName(table, identifier);
+}
+
+// Called by the tokenizer for every identifier, on the pool threads too
+void traceName(uint64_t identifier, const char* chars, size_t length) {
+	if (path == NULL) {
+		return;
+	}
+	if (buffer == NULL) {
+		_createBuffer();
+	}
+	Name* name = _addName(&buffer->names, identifier);
+	if (name->chars != NULL) {
+		return;
+	}
+	name->identifier = identifier;
+	name->chars = memoryAllocate(length + 1, MEMORY_TRACE);
+	memcpy(name->chars, chars, length);
+	name->chars[length] = '\0';
+	++buffer->names.count;
+}
+
+// At exit, when no other thread tokenizes
+static void _mergeNames(void) {
+	for (const Buffer* b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); b != NULL; b = b->next) {
+		for (size_t i = 0; i < b->names.capacity; ++i) {
+			const Name* from = &b->names.slots[i];
+			if (from->chars == NULL) {
+				continue;
+			}
+			Name* name = _addName(&names, from->identifier);
+			if (name->chars == NULL) {
+				*name = *from;
+				++names.count;
+			}
+		}
+	}
+}
+
+static void _writeEvent(FILE* file, const Buffer* b, const Event* event, bool* first) {
+	const pid_t pid = getpid();
+	const double ts = (event->time - start) / 1000.0;
+	fprintf(file, *first ? "\n" : ",\n");
+	*first = false;
+	switch (event->kind) {
+	case EVENT_ENTER: {
+		const Name* name = names.capacity == 0 ? NULL : _findName(&names, event->value);
+		if (name != NULL && name->chars != NULL) {
+			fprintf(file, "{\"name\":\"%s\"", name->chars);
+		}
+		else {
+			fprintf(file, "{\"name\":\"function %016lx\"", event->value);
+		}
+		fprintf(file, ",\"cat\":\"call\",\"ph\":\"B\",\"pid\":%i,\"tid\":%u,\"ts\":%.3f}", pid, b->thread, ts);
+		break;
+	}
+	case EVENT_PHASE:
+		if (event->value != 0) {
+			fprintf(file, "{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"B\",\"pid\":%i,\"tid\":%u,\"ts\":%.3f}",
+				(const char*)(uintptr_t)event->value, pid, b->thread, ts);
+			break;
+		}
+		__attribute__((fallthrough));
+	case EVENT_EXIT:
+		fprintf(file, "{\"ph\":\"E\",\"pid\":%i,\"tid\":%u,\"ts\":%.3f}", pid, b->thread, ts);
+		break;
+	case EVENT_LOOP:
+	default:
+		fprintf(file, "{\"name\":\"while\",\"cat\":\"loop\",\"ph\":\"X\",\"pid\":%i,\"tid\":%u,\"ts\":%.3f,"
+			"\"dur\":%.3f}", pid, b->thread, ts, event->value / 1000.0);
+		break;
+	}
+}
+
+static void _write(void) {
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Error: Failed to write trace to '%s'\n", path);
+		return;
+	}
+	_mergeNames();
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	bool first = true;
+	for (const Buffer* b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); b != NULL; b = b->next) {
+		const size_t kept = b->count < BUFFER_CAPACITY ? b->count : BUFFER_CAPACITY;
+		// Ends of calls and phases whose beginning was overwritten are left out
+		size_t depth = 0;
+		for (size_t i = b->count - kept; i < b->count; ++i) {
+			const Event* event = &b->events[i & (BUFFER_CAPACITY - 1)];
+			const bool ends = event->kind == EVENT_EXIT || (event->kind == EVENT_PHASE && event->value == 0);
+			if (ends && depth == 0) {
+				continue;
+			}
+			depth = ends ? depth - 1 : event->kind == EVENT_LOOP ? depth : depth + 1;
+			_writeEvent(file, b, event, &first);
+		}
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+}
+
+// Tracing lasts until the process exits, the file is written then
+void traceStart(const char* file) {
+	path = file;
+	start = _now();
+	evalSetTracing(true);
+	atexit(_write);
+}
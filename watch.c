@@ -0,0 +1,330 @@
+#define _POSIX_C_SOURCE 200809L
+#include "aardvark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+// NOTE:	Watch mode (--watch) runs a script and swaps in its new functions every time the file is saved
+//			- Every top level component keeps the range of source that it was parsed from
+//			- A reload compares the new source with the old one, and only the components between the first and
+//			  the last difference are tokenized and parsed again, the others keep their trees
+//			- Functions whose text changed are handed to resolveReload(), which replaces them in place
+//			- Top level statements have already run, changing them only prints a warning
+//			- Errors in the new source are reported and the program keeps running as it was
+//			- The inotify thread only sets a flag, the reload happens on the main thread at the next call
+//			- Types inferred for the old functions may not hold for the new ones, so they are all forgotten
+typedef struct Component	Component;
+struct Component {
+	size_t		begin;		// Offset of the first token
+	size_t		end;		// Offset of the next component, or the size of the source
+	uint64_t	identifier;	// Name of a function
+	bool		function;
+};
+
+typedef struct ComponentList	ComponentList;
+struct ComponentList {
+	Component*	components;
+	size_t		count;
+	size_t		capacity;
+};
+
+static const char* path = NULL;
+static const char* name = NULL;	// Of the file in its directory
+static int watcher = -1;
+static char* source = NULL;
+static size_t sourceSize = 0;
+static ComponentList current = {};
+static ParseNode* root = NULL;
+static ParseNode** reloaded = NULL;	// Nodes handed to resolveReload(), running frames may still use them
+static size_t reloadedCount = 0;
+
+static void _add(ComponentList* list, Component component) {
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+		list->components = memoryReallocate(list->components, list->capacity * sizeof *list->components,
+			MEMORY_ANALYSIS);
+	}
+	list->components[list->count++] = component;
+}
+
+static char* _read(size_t* size) {
+	const int file = open(path, O_RDONLY);
+	struct stat s;
+	if (file == -1 || fstat(file, &s) != 0) {
+		fprintf(stderr, "Error: Failed to open file '%s'\n", path);
+		if (file != -1) {
+			close(file);
+		}
+		return NULL;
+	}
+	char* chars = memoryAllocate(s.st_size, MEMORY_SOURCE);
+	size_t done = 0;
+	while (done < (size_t)s.st_size) {
+		const ssize_t length = read(file, chars + done, s.st_size - done);
+		if (length <= 0) {
+			break;
+		}
+		done += length;
+	}
+	close(file);
+	*size = done;
+	return chars;
+}
+
+// Parses chars[begin, end) into 'parent' and appends the ranges of its components to 'list'
+static bool _parseRange(const char* chars, size_t begin, size_t end, ParseNode* parent, ComponentList* list) {
+	TokenList tokens;
+	if (!tokenizeChecked(chars + begin, end - begin, true, &tokens)) {
+		return false;
+	}
+	TokenCursor t = { .syntax = tokens.syntax, .data = tokens.data };
+	const Syntax* const last = tokens.syntax + tokens.tokenCount;
+	const size_t first = list->count;
+	bool parsed = true;
+	while (t.syntax != last) {
+		const size_t offset = begin + tokens.offsets[t.syntax - tokens.syntax];
+		if (!parseNextComponent(&t, last, parent)) {
+			fprintf(stderr, "Error: Did not parse all tokens\n");
+			parsed = false;
+			break;
+		}
+		const ParseNode* node = &parent->children[parent->childCount - 1];
+		Component component = { .begin = offset, .function = node->syntax == SYNTAX_FUNCTION };
+		if (component.function) {
+			component.identifier = node->children[0].data.identifier;
+		}
+		_add(list, component);
+	}
+	for (size_t i = first; i < list->count; ++i) {
+		list->components[i].end = i + 1 < list->count ? list->components[i + 1].begin : end;
+	}
+	memoryFree(tokens.syntax);
+	memoryFree(tokens.data);
+	memoryFree(tokens.offsets);
+	return parsed;
+}
+
+// Whitespace before the next component does not count
+static bool _sameText(const char* a, const Component* x, const char* b, const Component* y) {
+	size_t xEnd = x->end;
+	size_t yEnd = y->end;
+	while (xEnd > x->begin && isspace((unsigned char)a[xEnd - 1])) {
+		--xEnd;
+	}
+	while (yEnd > y->begin && isspace((unsigned char)b[yEnd - 1])) {
+		--yEnd;
+	}
+	return xEnd - x->begin == yEnd - y->begin && memcmp(a + x->begin, b + y->begin, xEnd - x->begin) == 0;
+}
+
+// Index of the component that 'offset' of the current source belongs to
+static size_t _containing(size_t offset) {
+	size_t i = 0;
+	while (i + 1 < current.count && current.components[i].end <= offset) {
+		++i;
+	}
+	return i;
+}
+
+static const Component* _oldFunction(uint64_t identifier, size_t first, size_t last) {
+	for (size_t i = first; i <= last; ++i) {
+		if (current.components[i].function && current.components[i].identifier == identifier) {
+			return &current.components[i];
+		}
+	}
+	return NULL;
+}
+
+// Whether the top level statements of current[first, last] differ from those of 'fresh'
+static bool _statementsChanged(const char* chars, const ComponentList* fresh, size_t first, size_t last) {
+	size_t i = first;
+	for (size_t j = 0; j < fresh->count; ++j) {
+		if (fresh->components[j].function) {
+			continue;
+		}
+		while (i <= last && current.components[i].function) {
+			++i;
+		}
+		if (i > last || !_sameText(source, &current.components[i], chars, &fresh->components[j])) {
+			return true;
+		}
+		++i;
+	}
+	while (i <= last) {
+		if (!current.components[i++].function) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// The old source is replaced, components after the reparsed ones move by the change in size
+static void _replaceComponents(char* chars, size_t size, ComponentList* fresh, size_t first, size_t last) {
+	ComponentList merged = {};
+	for (size_t i = 0; i < first; ++i) {
+		_add(&merged, current.components[i]);
+	}
+	for (size_t i = 0; i < fresh->count; ++i) {
+		_add(&merged, fresh->components[i]);
+	}
+	for (size_t i = last + 1; i < current.count; ++i) {
+		Component component = current.components[i];
+		component.begin = component.begin + size - sourceSize;
+		component.end = component.end + size - sourceSize;
+		_add(&merged, component);
+	}
+	memoryFree(current.components);
+	memoryFree(fresh->components);
+	current = merged;
+	memoryFree(source);
+	source = chars;
+	sourceSize = size;
+}
+
+void watchReload(void) {
+	size_t size;
+	char* chars = _read(&size);
+	if (chars == NULL) {
+		return;
+	}
+	const size_t shorter = size < sourceSize ? size : sourceSize;
+	size_t prefix = 0;
+	while (prefix < shorter && chars[prefix] == source[prefix]) {
+		++prefix;
+	}
+	if (prefix == size && size == sourceSize) {
+		memoryFree(chars);
+		return;
+	}
+	size_t suffix = 0;
+	while (suffix < shorter - prefix && chars[size - 1 - suffix] == source[sourceSize - 1 - suffix]) {
+		++suffix;
+	}
+	// One more component on each side, an edit at a boundary may change how the previous one ends
+	size_t first = _containing(prefix);
+	size_t last = _containing(sourceSize - suffix > prefix ? sourceSize - suffix - 1 : prefix);
+	first = first == 0 ? 0 : first - 1;
+	last = last + 1 < current.count ? last + 1 : last;
+	const size_t begin = current.count == 0 || first == 0 ? 0 : current.components[first].begin;
+	const size_t end = current.count == 0 || last + 1 == current.count ? size
+		: current.components[last].end + size - sourceSize;
+	ParseNode holder;
+	parseNodeCreate(&holder, SYNTAX_PROGRAM);
+	ComponentList fresh = {};
+	if (!_parseRange(chars, begin, end, &holder, &fresh)) {
+		fprintf(stderr, "Reload of '%s' failed, the program is unchanged\n", path);
+		parseTreeFree(&holder);
+		memoryFree(fresh.components);
+		memoryFree(chars);
+		return;
+	}
+	if (current.count == 0) {
+		// Nothing to compare with
+		first = 1;
+		last = 0;
+	}
+	ParseNode** changed = memoryAllocate(fresh.count * sizeof *changed, MEMORY_SYNTAX_TREE);
+	size_t changedCount = 0;
+	for (size_t i = 0; i < fresh.count; ++i) {
+		if (!fresh.components[i].function) {
+			continue;
+		}
+		const Component* old = _oldFunction(fresh.components[i].identifier, first, last);
+		if (old != NULL && _sameText(source, old, chars, &fresh.components[i])) {
+			continue;
+		}
+		// Moved out of the holder, its address must not change
+		ParseNode* function = memoryAllocate(sizeof *function, MEMORY_SYNTAX_TREE);
+		*function = holder.children[i];
+		holder.children[i].children = NULL;
+		holder.children[i].childCount = 0;
+		changed[changedCount++] = function;
+	}
+	if (changedCount != 0 && !resolveReload(changed, changedCount)) {
+		fprintf(stderr, "Reload of '%s' failed, the program is unchanged\n", path);
+		for (size_t i = 0; i < changedCount; ++i) {
+			parseTreeFree(changed[i]);
+			memoryFree(changed[i]);
+		}
+		memoryFree(changed);
+		parseTreeFree(&holder);
+		memoryFree(fresh.components);
+		memoryFree(chars);
+		return;
+	}
+	if (_statementsChanged(chars, &fresh, first, last)) {
+		fprintf(stderr, "Warning: Top level statements of '%s' changed, restart to run them\n", path);
+	}
+	reloaded = memoryReallocate(reloaded, (reloadedCount + changedCount) * sizeof *reloaded, MEMORY_SYNTAX_TREE);
+	memcpy(reloaded + reloadedCount, changed, changedCount * sizeof *changed);
+	reloadedCount += changedCount;
+	if (changedCount != 0) {
+		evalForgetTypes(root);
+		for (size_t i = 0; i < reloadedCount; ++i) {
+			evalForgetTypes(reloaded[i]);
+		}
+	}
+	memoryFree(changed);
+	parseTreeFree(&holder);
+	_replaceComponents(chars, size, &fresh, current.count == 0 ? 0 : first, current.count == 0 ? 0 : last);
+	fprintf(stderr, "Reloaded '%s', %zu function(s) replaced\n", path, changedCount);
+}
+
+static void* _watch(void* unused) {
+	(void)unused;
+	char buffer[sizeof(struct inotify_event) + NAME_MAX + 1] __attribute__((aligned(8)));
+	while (true) {
+		const ssize_t length = read(watcher, buffer, sizeof buffer);
+		if (length <= 0) {
+			return NULL;
+		}
+		for (const char* it = buffer; it < buffer + length;) {
+			const struct inotify_event* event = (const struct inotify_event*)it;
+			if (event->len != 0 && strcmp(event->name, name) == 0) {
+				evalRequestReload();
+			}
+			it += sizeof *event + event->len;
+		}
+	}
+}
+
+// Editors often save by renaming a new file over the old one, so the directory is watched
+static void _startWatching(void) {
+	const char* slash = strrchr(path, '/');
+	name = slash == NULL ? path : slash + 1;
+	char directory[PATH_MAX];
+	snprintf(directory, sizeof directory, "%.*s", slash == NULL ? 1 : slash == path ? 1 : (int)(slash - path),
+		slash == NULL ? "." : path);
+	watcher = inotify_init();
+	pthread_t thread;
+	if (watcher == -1 || inotify_add_watch(watcher, directory, IN_CLOSE_WRITE | IN_MOVED_TO) == -1
+		|| pthread_create(&thread, NULL, _watch, NULL) != 0) {
+		fprintf(stderr, "Error: Failed to watch '%s'\n", path);
+		exit(EXIT_FAILURE);
+	}
+	pthread_detach(thread);
+}
+
+// Runs the script in 'chars', which is kept to compare with the next version of the file
+Data watchRun(const char* file, char* chars, size_t size) {
+	path = file;
+	source = chars;
+	sourceSize = size;
+	root = memoryAllocate(sizeof *root, MEMORY_SYNTAX_TREE);
+	parseNodeCreate(root, SYNTAX_PROGRAM);
+	if (!_parseRange(chars, 0, size, root, &current)) {
+		exit(EXIT_FAILURE);
+	}
+	resolveProgram(root);
+	inferProgram(root);
+	_startWatching();
+	return eval(root);
+}